@@ -0,0 +1,114 @@
+#include "BufferPool.h"
+#include <QtGlobal>
+#include <utility>
+
+PooledBuffer::PooledBuffer(BufferPool *pool, char *data, int size)
+    : m_pool(pool), m_data(data), m_size(size)
+{
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+    : m_pool(other.m_pool), m_data(other.m_data), m_size(other.m_size)
+{
+    other.m_pool = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+{
+    if (this != &other) {
+        if (m_pool && m_data) {
+            m_pool->release(m_data, m_size);
+        }
+        m_pool = other.m_pool;
+        m_data = other.m_data;
+        m_size = other.m_size;
+        other.m_pool = nullptr;
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    if (m_pool && m_data) {
+        m_pool->release(m_data, m_size);
+    }
+}
+
+BufferPool &BufferPool::instance()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+int BufferPool::sizeClass(int size)
+{
+    int index = 12; // 4096 == Alignment
+    while ((1 << index) < size && index < ClassCount - 1) {
+        ++index;
+    }
+    return index;
+}
+
+PooledBuffer BufferPool::acquire(int size)
+{
+    int index = sizeClass(size);
+    int blockSize = 1 << index;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_free[index].isEmpty()) {
+            char *data = m_free[index].takeLast();
+            m_cachedBytes -= blockSize;
+            return PooledBuffer(this, data, blockSize);
+        }
+    }
+
+    char *data = static_cast<char *>(qMallocAligned(blockSize, Alignment));
+    if (!data) {
+        return PooledBuffer();
+    }
+    return PooledBuffer(this, data, blockSize);
+}
+
+void BufferPool::release(char *data, int size)
+{
+    int index = sizeClass(size);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_free[index].size() < MaxCachedPerClass) {
+            m_free[index].append(data);
+            m_cachedBytes += size;
+            return;
+        }
+    }
+
+    qFreeAligned(data);
+}
+
+void BufferPool::trim()
+{
+    QMutexLocker locker(&m_mutex);
+    for (int i = 0; i < ClassCount; ++i) {
+        for (char *data : std::as_const(m_free[i])) {
+            qFreeAligned(data);
+        }
+        m_free[i].clear();
+    }
+    m_cachedBytes = 0;
+}
+
+qint64 BufferPool::cachedBytes() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cachedBytes;
+}
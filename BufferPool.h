@@ -0,0 +1,78 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QMutex>
+#include <QVector>
+
+class BufferPool;
+
+// Aligned block borrowed from BufferPool, returned to it on destruction
+class PooledBuffer
+{
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer &&other) noexcept;
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+    ~PooledBuffer();
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    char *data() { return m_data; }
+    const char *constData() const { return m_data; }
+    unsigned char *bytes() { return reinterpret_cast<unsigned char *>(m_data); }
+    int size() const { return m_size; }
+    bool isNull() const { return m_data == nullptr; }
+
+private:
+    friend class BufferPool;
+    PooledBuffer(BufferPool *pool, char *data, int size);
+
+    BufferPool *m_pool = nullptr;
+    char *m_data = nullptr;
+    int m_size = 0;
+};
+
+// 对齐缓冲区池
+// File operations borrow their chunk buffers from here instead of allocating
+// per file or per chunk. Blocks are page aligned (usable with O_DIRECT) and
+// grouped in power-of-two size classes; released blocks are kept for reuse so
+// steady-state batch work does no heap allocation and RSS stays flat.
+class BufferPool
+{
+public:
+    static BufferPool &instance();
+
+    // Block of at least size bytes
+    PooledBuffer acquire(int size);
+
+    // Bytes actually held by a block acquired for size
+    static int blockSize(int size) { return 1 << sizeClass(size); }
+
+    // Free all cached blocks (in-use blocks are unaffected)
+    void trim();
+
+    qint64 cachedBytes() const;
+
+    static const int Alignment = 4096;
+    static const int ChunkSize = 1024 * 1024;
+
+private:
+    friend class PooledBuffer;
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    void release(char *data, int size);
+    static int sizeClass(int size);
+
+    // Keep at most this many idle blocks per size class
+    static const int MaxCachedPerClass = 64;
+    static const int ClassCount = 31;
+
+    mutable QMutex m_mutex;
+    QVector<char *> m_free[ClassCount];
+    qint64 m_cachedBytes = 0;
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,478 @@
+#include "BulkFileOperation.h"
+#include "FastFileCopy.h"
+#include "JobScheduler.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QThread>
+#include <memory>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifndef FNM_CASEFOLD
+#define FNM_CASEFOLD 0
+#endif
+#endif
+
+namespace {
+
+// 每个任务处理的文件数量
+const int kEntriesPerChunk = 256;
+// 汇总信息中最多保留的错误条数
+const int kMaxReportedErrors = 10;
+
+// Directory descriptor shared by every chunk of the same directory,
+// closed when the last chunk referencing it is done
+struct DirHandle
+{
+    explicit DirHandle(const QString &dirPath) : path(dirPath)
+    {
+#ifdef Q_OS_UNIX
+        fd = ::open(QFile::encodeName(dirPath).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            openErrno = errno;
+        }
+#endif
+    }
+
+    ~DirHandle()
+    {
+#ifdef Q_OS_UNIX
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    QString path;
+    int fd = -1;
+    int openErrno = 0;
+};
+
+bool hasWildcard(const QString &name)
+{
+    return name.contains('*') || name.contains('?') || name.contains('[');
+}
+
+// Names of the regular files in a directory matching any of the patterns
+QStringList matchNames(const QString &directoryPath, const QStringList &patterns)
+{
+    QStringList names;
+
+#ifdef Q_OS_UNIX
+    // readdir + fnmatch avoids the per-entry stat that QDir::entryList does
+    QList<QByteArray> encodedPatterns;
+    for (const QString &pattern : patterns) {
+        encodedPatterns.append(QFile::encodeName(pattern));
+    }
+
+    DIR *dir = ::opendir(QFile::encodeName(directoryPath).constData());
+    if (!dir) {
+        return names;
+    }
+
+    int dirFd = ::dirfd(dir);
+    while (struct dirent *entry = ::readdir(dir)) {
+        // Hidden files are skipped, as with QDir::entryList
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        bool isFile = entry->d_type == DT_REG || entry->d_type == DT_LNK;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isFile = ::fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                     && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode));
+        }
+        if (!isFile) {
+            continue;
+        }
+
+        for (const QByteArray &pattern : encodedPatterns) {
+            if (::fnmatch(pattern.constData(), entry->d_name, FNM_CASEFOLD) == 0) {
+                names.append(QFile::decodeName(entry->d_name));
+                break;
+            }
+        }
+    }
+    ::closedir(dir);
+#else
+    QDir dir(directoryPath);
+    names = dir.entryList(patterns, QDir::Files | QDir::NoDotAndDotDot);
+#endif
+
+    return names;
+}
+
+#ifdef Q_OS_UNIX
+// Copy one entry between two open directories. The data goes to a temporary
+// name first and is renamed over the destination only when complete, so a
+// failed copy never destroys an existing file of that name.
+bool copyAt(int srcDirFd, const char *name, int dstDirFd)
+{
+    static std::atomic<unsigned> sequence(0);
+
+    int in = ::openat(srcDirFd, name, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(in, &st) != 0) {
+        int savedErrno = errno;
+        ::close(in);
+        errno = savedErrno;
+        return false;
+    }
+
+    QByteArray tempName;
+    int out = -1;
+    for (int attempt = 0; attempt < 100 && out < 0; ++attempt) {
+        tempName = "." + QByteArray(name) + "." + QByteArray::number(qint64(::getpid())) + "-"
+                   + QByteArray::number(sequence.fetch_add(1)) + ".tmp";
+        out = ::openat(dstDirFd, tempName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+        if (out < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    if (out < 0) {
+        int savedErrno = errno;
+        ::close(in);
+        errno = savedErrno;
+        return false;
+    }
+
+    bool ok = FastFileCopy::copyDescriptor(in, out);
+
+    int savedErrno = errno;
+    ::close(in);
+    if (::close(out) != 0 && ok) {
+        savedErrno = errno;
+        ok = false;
+    }
+    if (ok && ::renameat(dstDirFd, tempName.constData(), dstDirFd, name) != 0) {
+        savedErrno = errno;
+        ok = false;
+    }
+    if (!ok) {
+        ::unlinkat(dstDirFd, tempName.constData(), 0);
+    }
+    errno = savedErrno;
+    return ok;
+}
+
+// Both descriptors refer to the same directory
+bool sameDirectory(int a, int b)
+{
+    struct stat first;
+    struct stat second;
+    return ::fstat(a, &first) == 0 && ::fstat(b, &second) == 0
+           && first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+#endif
+
+} // namespace
+
+struct BulkFileOperation::Chunk
+{
+    std::shared_ptr<DirHandle> source;
+    std::shared_ptr<DirHandle> dest;
+    QList<QByteArray> names;
+    // Copy/move into the directory the files already are in: every entry is
+    // refused, it would replace the source with itself
+    bool intoSource = false;
+};
+
+BulkFileOperation::BulkFileOperation(QObject *parent)
+    : QObject(parent),
+      m_operation(Delete),
+      m_priority(JobScheduler::Background),
+      m_running(false),
+      m_cancelled(false),
+      m_total(0),
+      m_done(0),
+      m_failed(0),
+      m_pendingChunks(0),
+      m_lastPercentage(0),
+      m_succeeded(false)
+{
+    // Metadata operations are I/O bound, so oversubscribe the CPU count
+    m_pool.setMaxThreadCount(qBound(4, QThread::idealThreadCount() * 2, 32));
+}
+
+BulkFileOperation::~BulkFileOperation()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+QStringList BulkFileOperation::expandPatterns(const QString &directoryPath, const QStringList &patterns)
+{
+    QDir dir(directoryPath);
+    QStringList files;
+    for (const QString &name : matchNames(directoryPath, patterns)) {
+        files.append(dir.absoluteFilePath(name));
+    }
+    return files;
+}
+
+bool BulkFileOperation::start(Operation operation, const QStringList &files, const QString &destDir,
+                              JobScheduler::Priority priority)
+{
+    if (m_running.exchange(true)) {
+        return false;
+    }
+
+    // Resolve globs and group the entries by parent directory
+    QHash<QString, QList<QByteArray>> byDirectory;
+    int total = 0;
+    for (const QString &entry : files) {
+        QFileInfo info(entry);
+        QString dirPath = info.absolutePath();
+        QString name = info.fileName();
+
+        if (name.isEmpty()) {
+            continue;
+        }
+
+        QList<QByteArray> &names = byDirectory[dirPath];
+        if (hasWildcard(name)) {
+            for (const QString &match : matchNames(dirPath, QStringList() << name)) {
+                names.append(QFile::encodeName(match));
+                ++total;
+            }
+        } else {
+            names.append(QFile::encodeName(name));
+            ++total;
+        }
+    }
+
+    if (total == 0) {
+        m_running = false;
+        return false;
+    }
+
+    std::shared_ptr<DirHandle> dest;
+    if (operation != Delete) {
+        if (destDir.isEmpty()) {
+            m_running = false;
+            return false;
+        }
+        QDir().mkpath(destDir);
+        dest = std::make_shared<DirHandle>(QFileInfo(destDir).absoluteFilePath());
+    }
+
+    QList<Chunk> chunks;
+    for (auto it = byDirectory.constBegin(); it != byDirectory.constEnd(); ++it) {
+        auto source = std::make_shared<DirHandle>(it.key());
+        bool intoSource = false;
+        if (dest) {
+#ifdef Q_OS_UNIX
+            intoSource = source->fd >= 0 && dest->fd >= 0 && sameDirectory(source->fd, dest->fd);
+#else
+            intoSource = QFileInfo(source->path).canonicalFilePath() == QFileInfo(dest->path).canonicalFilePath();
+#endif
+        }
+        const QList<QByteArray> &names = it.value();
+        for (int i = 0; i < names.size(); i += kEntriesPerChunk) {
+            Chunk chunk;
+            chunk.source = source;
+            chunk.dest = dest;
+            chunk.intoSource = intoSource;
+            chunk.names = names.mid(i, kEntriesPerChunk);
+            chunks.append(chunk);
+        }
+    }
+
+    m_operation = operation;
+    m_priority = priority;
+    m_cancelled = false;
+    m_total = total;
+    m_done = 0;
+    m_failed = 0;
+    m_lastPercentage = 0;
+    m_pendingChunks = chunks.size();
+    {
+        QMutexLocker locker(&m_errorMutex);
+        m_errors.clear();
+    }
+
+    for (const Chunk &chunk : chunks) {
+        m_pool.start([this, chunk]() { runChunk(chunk); });
+    }
+
+    return true;
+}
+
+bool BulkFileOperation::isRunning() const
+{
+    return m_running.load();
+}
+
+void BulkFileOperation::cancel()
+{
+    m_cancelled = true;
+}
+
+bool BulkFileOperation::waitForFinished()
+{
+    m_pool.waitForDone();
+    return m_succeeded.load();
+}
+
+void BulkFileOperation::runChunk(const Chunk &chunk)
+{
+    // Housekeeping steps aside whenever crypto work is active, unless the
+    // caller is waiting for it (m_priority == Interactive never parks)
+    JobScheduler::Scope scheduling(m_priority);
+
+#ifdef Q_OS_UNIX
+    int srcFd = chunk.source->fd;
+    int dstFd = chunk.dest ? chunk.dest->fd : -1;
+    bool dirsOpen = srcFd >= 0 && (m_operation == Delete || dstFd >= 0);
+    int dirErrno = srcFd < 0 ? chunk.source->openErrno : (chunk.dest ? chunk.dest->openErrno : 0);
+#endif
+
+    for (const QByteArray &name : chunk.names) {
+        if (m_cancelled.load()) {
+            break;
+        }
+        JobScheduler::instance().yieldPoint();
+
+        bool ok = false;
+
+        if (chunk.intoSource) {
+            recordError(chunk.source->path + "/" + QFile::decodeName(name) + ": 源文件与目标文件相同");
+            entryDone(false);
+            continue;
+        }
+
+#ifdef Q_OS_UNIX
+        if (!dirsOpen) {
+            errno = dirErrno;
+        } else if (m_operation == Delete) {
+            ok = ::unlinkat(srcFd, name.constData(), 0) == 0;
+        } else if (m_operation == Copy) {
+            ok = copyAt(srcFd, name.constData(), dstFd);
+        } else {
+            ok = ::renameat(srcFd, name.constData(), dstFd, name.constData()) == 0;
+            if (!ok && errno == EXDEV) {
+                // Different filesystem: copy, then remove the source
+                ok = copyAt(srcFd, name.constData(), dstFd)
+                     && ::unlinkat(srcFd, name.constData(), 0) == 0;
+            }
+        }
+
+        if (!ok) {
+            recordError(chunk.source->path + "/" + QFile::decodeName(name) + ": " + QString::fromLocal8Bit(strerror(errno)));
+        }
+#else
+        QString sourcePath = chunk.source->path + "/" + QFile::decodeName(name);
+        QFile file(sourcePath);
+        if (m_operation == Delete) {
+            ok = file.remove();
+        } else {
+            // Staged under a temporary name: the existing destination is only
+            // replaced once the copy (or the move) has succeeded
+            QString destPath = chunk.dest->path + "/" + QFile::decodeName(name);
+            QString tempPath = chunk.dest->path + "/." + QFile::decodeName(name) + ".tmp";
+            QFile::remove(tempPath);
+            ok = m_operation == Copy ? file.copy(tempPath) : file.rename(tempPath);
+            if (ok && QFile::exists(destPath) && !QFile::remove(destPath)) {
+                ok = false;
+            }
+            if (ok && !QFile::rename(tempPath, destPath)) {
+                ok = false;
+            }
+            if (!ok && m_operation == Copy) {
+                QFile::remove(tempPath);
+            }
+        }
+
+        if (!ok) {
+            recordError(sourcePath + ": " + file.errorString());
+        }
+#endif
+
+        entryDone(ok);
+    }
+
+    if (m_pendingChunks.fetch_sub(1) == 1) {
+        finish();
+    }
+}
+
+void BulkFileOperation::recordError(const QString &error)
+{
+    QMutexLocker locker(&m_errorMutex);
+    if (m_errors.size() < kMaxReportedErrors) {
+        m_errors.append(error);
+    }
+}
+
+void BulkFileOperation::entryDone(bool ok)
+{
+    if (!ok) {
+        m_failed.fetch_add(1);
+    }
+
+    // Only emit when the percentage actually moves, not once per file
+    int done = m_done.fetch_add(1) + 1;
+    int percentage = int(qint64(done) * 100 / m_total.load());
+    int last = m_lastPercentage.load();
+    while (percentage > last) {
+        if (m_lastPercentage.compare_exchange_weak(last, percentage)) {
+            emit progressUpdate(percentage);
+            break;
+        }
+    }
+}
+
+void BulkFileOperation::finish()
+{
+    int failed = m_failed.load();
+    int succeeded = m_done.load() - failed;
+
+    QString verb;
+    switch (m_operation) {
+    case Delete:
+        verb = "删除";
+        break;
+    case Copy:
+        verb = "复制";
+        break;
+    case Move:
+        verb = "移动";
+        break;
+    }
+
+    QString message = QString("已%1 %2 个文件").arg(verb).arg(succeeded);
+    if (failed > 0) {
+        message += QString(", %1 个文件%2失败").arg(failed).arg(verb);
+    }
+    if (m_cancelled.load()) {
+        message += ", 操作已取消";
+    }
+
+    {
+        QMutexLocker locker(&m_errorMutex);
+        if (!m_errors.isEmpty()) {
+            message += ": " + m_errors.first();
+        }
+    }
+
+    bool success = failed == 0 && !m_cancelled.load();
+    m_succeeded = success;
+    m_running = false;
+
+    emit progressUpdate(100);
+    emit finished(success, succeeded, failed, message);
+}
@@ -0,0 +1,77 @@
+#ifndef BULKFILEOPERATION_H
+#define BULKFILEOPERATION_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QMutex>
+#include "JobScheduler.h"
+#include <atomic>
+
+// 批量文件操作（删除/复制/移动）
+// Files are grouped by parent directory, each directory is opened once and the
+// entries are processed relative to its descriptor (unlinkat/openat/renameat)
+// on an I/O worker pool. Progress is aggregated across all workers and a single
+// summary is emitted when the whole batch has finished.
+class BulkFileOperation : public QObject
+{
+    Q_OBJECT
+public:
+    enum Operation {
+        Delete,
+        Copy,
+        Move
+    };
+    Q_ENUM(Operation)
+
+    explicit BulkFileOperation(QObject *parent = nullptr);
+    ~BulkFileOperation();
+
+    // Expand shell-style patterns ("*.tmp") inside a directory into absolute file paths
+    static QStringList expandPatterns(const QString &directoryPath, const QStringList &patterns);
+
+    // Start a batch. Entries may be plain paths or globs ("/tmp/stage/*.enc").
+    // Returns false if a batch is already running or there is nothing to do.
+    // Batches run as Background work and step aside for crypto jobs; a caller
+    // that blocks on the result (waitForFinished on the GUI thread) passes
+    // Interactive so the chunks never park.
+    bool start(Operation operation, const QStringList &files, const QString &destDir = QString(),
+               JobScheduler::Priority priority = JobScheduler::Background);
+    bool isRunning() const;
+    void cancel();
+
+    // Block until the running batch has finished; true if every entry succeeded.
+    // finished() is still emitted (queued to the receiver's thread).
+    bool waitForFinished();
+
+signals:
+    void progressUpdate(int percentage);
+    void finished(bool success, int succeeded, int failed, const QString &message);
+
+private:
+    struct Chunk;
+
+    void runChunk(const Chunk &chunk);
+    void recordError(const QString &error);
+    void entryDone(bool ok);
+    void finish();
+
+    QThreadPool m_pool;
+    Operation m_operation;
+    JobScheduler::Priority m_priority;
+
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_cancelled;
+    std::atomic<int> m_total;
+    std::atomic<int> m_done;
+    std::atomic<int> m_failed;
+    std::atomic<int> m_pendingChunks;
+    std::atomic<int> m_lastPercentage;
+    std::atomic<bool> m_succeeded;
+
+    QMutex m_errorMutex;
+    QStringList m_errors;
+};
+
+#endif // BULKFILEOPERATION_H
@@ -0,0 +1,132 @@
+#include "ContentManifest.h"
+#include "BufferPool.h"
+#include "JobScheduler.h"
+#include "MemoryBudget.h"
+#include "StorageTuner.h"
+#include "ThreadDigest.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+
+
+namespace {
+
+QString absolutePath(const QString &path)
+{
+    return QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+}
+
+} // namespace
+
+QByteArray ContentManifest::hashFile(const QString &path, PageCacheAdvisor::Mode cacheMode)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return QByteArray();
+    }
+
+    EVP_MD_CTX *md = ThreadDigest::context(ThreadDigest::Plaintext);
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), nullptr) != 1) {
+        return QByteArray();
+    }
+
+    const int chunkSize = StorageTuner::instance().chunkSize(&file);
+    MemoryBudget::Reservation memory(BufferPool::blockSize(chunkSize));
+    PooledBuffer buffer = BufferPool::instance().acquire(chunkSize);
+    if (buffer.isNull()) {
+        return QByteArray();
+    }
+
+    PageCacheAdvisor cache(&file, PageCacheAdvisor::Input, cacheMode);
+    for (;;) {
+        JobScheduler::instance().yieldPoint();
+        cache.prepare();
+        qint64 bytesRead = file.read(buffer.data(), buffer.size());
+        if (bytesRead < 0) {
+            return QByteArray();
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        EVP_DigestUpdate(md, buffer.bytes(), size_t(bytesRead));
+        cache.advance();
+    }
+
+    QByteArray hash(EVP_MAX_MD_SIZE, Qt::Uninitialized);
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(md, reinterpret_cast<unsigned char*>(hash.data()), &length);
+    hash.resize(int(length));
+    return hash;
+}
+
+void ContentManifest::add(const QString &path, const QByteArray &hash)
+{
+    QString absolute = absolutePath(path);
+    QMutexLocker locker(&m_mutex);
+    m_entries.insert(absolute, hash);
+}
+
+bool ContentManifest::save(const QString &manifestPath) const
+{
+    QDir base = QFileInfo(manifestPath).absoluteDir();
+    QString basePrefix = QDir::cleanPath(base.absolutePath()) + "/";
+
+    QSaveFile file(manifestPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    QTextStream stream(&file);
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        QString path = it.key().startsWith(basePrefix) ? it.key().mid(basePrefix.length()) : it.key();
+        stream << it.value().toHex() << "  " << path << "\n";
+    }
+    stream.flush();
+    return file.commit();
+}
+
+bool ContentManifest::load(const QString &manifestPath)
+{
+    QFile file(manifestPath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+
+    QDir base = QFileInfo(manifestPath).absoluteDir();
+    QMap<QString, QByteArray> entries;
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+
+        // "<64 hex>  <path>"; sha256sum marks binary mode with '*' instead of the second space
+        if (line.length() < 67 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*')) {
+            return false;
+        }
+        QByteArray hash = QByteArray::fromHex(line.left(64).toLatin1());
+        if (hash.size() != 32) {
+            return false;
+        }
+        entries.insert(QDir::cleanPath(base.absoluteFilePath(line.mid(66))), hash);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_entries = entries;
+    return true;
+}
+
+QMap<QString, QByteArray> ContentManifest::entries() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries;
+}
+
+int ContentManifest::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
@@ -0,0 +1,38 @@
+#ifndef CONTENTMANIFEST_H
+#define CONTENTMANIFEST_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include "PageCacheAdvisor.h"
+
+// 内容校验清单
+// SHA-256 checksums of sources and outputs for audits. The file format is the
+// one sha256sum writes ("<hex>  <path>" per line), so a manifest can also be
+// checked with "sha256sum -c" from the manifest's directory. Paths below that
+// directory are stored relative to it, everything else absolute.
+// add() is safe to call from worker threads.
+class ContentManifest
+{
+public:
+    // SHA-256 of a whole file, read in pooled chunks. OpenSSL picks the
+    // SHA-NI / AVX2 code path at runtime. Empty on read errors.
+    static QByteArray hashFile(const QString &path, PageCacheAdvisor::Mode cacheMode = PageCacheAdvisor::Cached);
+
+    // Raw hash of the file at path (absolute or relative to the working directory)
+    void add(const QString &path, const QByteArray &hash);
+
+    bool save(const QString &manifestPath) const;
+    bool load(const QString &manifestPath);
+
+    // Absolute path -> raw hash, sorted by path
+    QMap<QString, QByteArray> entries() const;
+    int size() const;
+
+private:
+    mutable QMutex m_mutex;
+    QMap<QString, QByteArray> m_entries;
+};
+
+#endif // CONTENTMANIFEST_H
@@ -0,0 +1,612 @@
+#include "CryptoCli.h"
+#include "CryptoDaemon.h"
+#include "CryptoManager.h"
+#include "CryptoMetrics.h"
+#include "FileCatalog.h"
+#include "MemoryBudget.h"
+#include "StreamEndpoint.h"
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <csignal>
+#include <functional>
+
+namespace {
+
+// Exit codes
+const int kExitOk = 0;
+const int kExitFailed = 1;
+const int kExitUsage = 2;
+
+struct CliContext
+{
+    CryptoManager &crypto;
+    const QCommandLineParser &parser;
+    QStringList args; // positional arguments after the command
+};
+
+typedef int (*CommandHandler)(CliContext &context);
+
+struct Command
+{
+    const char *name;
+    const char *usage;
+    int minArgs;
+    CommandHandler handler;
+    // Positional arguments that are paths, made absolute before a command is
+    // handed to the daemon: pathCount of them from firstPath, -1 for the rest
+    int firstPath;
+    int pathCount;
+};
+
+struct Option
+{
+    const char *name;
+    const char *description;
+    const char *valueName; // nullptr for flags
+    bool isPath;
+    bool forwarded;        // passed on to the daemon
+};
+
+const Option kOptions[] = {
+    { "password", "Password for AES mode or the private key.", "password", false, true },
+    { "key", "Key name for hybrid mode.", "name", false, true },
+    { "new-key", "Key name to rewrap hybrid files for.", "name", false, true },
+    { "xor-key", "Key of legacy XOR files (or SAFE_XOR_KEY).", "key", false, true },
+    { "manifest", "Add sources and outputs to this checksum manifest.", "file", true, true },
+    { "priority", "Scheduling class: interactive, normal or background.", "class", false, true },
+    { "memory-budget", "Cap in-flight crypto buffers at this many MiB for this run.", "MiB", false, true },
+    { "cache", "Page cache use: cached, drop-behind or direct.", "mode", false, true },
+    { "metrics", "Print crypto metrics as JSON to stdout when done.", nullptr, false, true },
+    { "trace", "Write a Chrome trace_event file when done.", "file", true, true },
+    { "daemon", "Run in the background daemon when one is running (or SAFE_DAEMON=1).", nullptr, false, false },
+};
+
+// Streams of the command running on this thread; the daemon points them at
+// the client's connection, everything else writes to stdout/stderr
+thread_local QTextStream *commandOut = nullptr;
+thread_local QTextStream *commandErr = nullptr;
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return commandOut ? *commandOut : stream;
+}
+
+QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return commandErr ? *commandErr : stream;
+}
+
+// Password from --password, falling back to SAFE_PASSWORD so it stays out of ps output
+QString password(const CliContext &context)
+{
+    if (context.parser.isSet("password")) {
+        return context.parser.value("password");
+    }
+    return qEnvironmentVariable("SAFE_PASSWORD");
+}
+
+// Ctrl+C cancels the running operation; a second one kills the process.
+// Resumable encryptions keep their checkpoint and continue on the next run.
+CryptoManager *runningCrypto = nullptr;
+
+void cancelOnSignal(int signalNumber)
+{
+    std::signal(signalNumber, SIG_DFL);
+    if (runningCrypto) {
+        runningCrypto->cancelOperation();
+    }
+}
+
+int exitCode(bool ok)
+{
+    return ok ? kExitOk : kExitFailed;
+}
+
+// "-" (stdin/stdout), "fd:N" or "unix:PATH" on either side streams the data
+// instead of going through files: pg_dump | safe cli encrypt-aes - backup.aes
+bool isStream(const CliContext &context)
+{
+    return StreamEndpoint::isStreamSpec(context.args[0]) || StreamEndpoint::isStreamSpec(context.args[1]);
+}
+
+int runStream(const CliContext &context, const std::function<bool(QIODevice *, QIODevice *)> &operation)
+{
+    QString error;
+    QScopedPointer<QIODevice> in(StreamEndpoint::open(context.args[0], QIODevice::ReadOnly, error));
+    QScopedPointer<QIODevice> out(in ? StreamEndpoint::open(context.args[1], QIODevice::WriteOnly, error) : nullptr);
+    if (!in || !out) {
+        err() << "error: " << error << "\n";
+        return kExitFailed;
+    }
+
+    bool ok = operation(in.data(), out.data());
+    out->close();
+    // A plain output file is not left half written
+    if (!ok && !StreamEndpoint::isStreamSpec(context.args[1])) {
+        QFile::remove(context.args[1]);
+    }
+    return exitCode(ok);
+}
+
+int encryptAes(CliContext &context)
+{
+    if (isStream(context)) {
+        return runStream(context, [&](QIODevice *in, QIODevice *out) {
+            return context.crypto.encryptStream(in, out, password(context));
+        });
+    }
+    return exitCode(context.crypto.encryptFileAES(context.args[0], context.args[1], password(context)));
+}
+
+int decryptAes(CliContext &context)
+{
+    if (isStream(context)) {
+        return runStream(context, [&](QIODevice *in, QIODevice *out) {
+            return context.crypto.decryptStream(in, out, password(context));
+        });
+    }
+    return exitCode(context.crypto.decryptFileAES(context.args[0], context.args[1], password(context)));
+}
+
+int encryptHybrid(CliContext &context)
+{
+    // --key a,b,c wraps the content key for every listed recipient
+    QStringList keys = context.parser.value("key").split(',', Qt::SkipEmptyParts);
+    if (isStream(context)) {
+        return runStream(context, [&](QIODevice *in, QIODevice *out) {
+            return context.crypto.encryptStreamHybrid(in, out, keys);
+        });
+    }
+    if (keys.size() > 1) {
+        return exitCode(context.crypto.encryptFileHybridMulti(context.args[0], context.args[1], keys));
+    }
+    return exitCode(context.crypto.encryptFileHybrid(context.args[0], context.args[1], context.parser.value("key")));
+}
+
+int decryptHybrid(CliContext &context)
+{
+    if (isStream(context)) {
+        return runStream(context, [&](QIODevice *in, QIODevice *out) {
+            return context.crypto.decryptStreamHybrid(in, out, context.parser.value("key"), password(context));
+        });
+    }
+    return exitCode(context.crypto.decryptFileHybrid(context.args[0], context.args[1],
+                                                     context.parser.value("key"), password(context)));
+}
+
+int rewrapHybrid(CliContext &context)
+{
+    const QString &path = context.args[0];
+    QString oldKey = context.parser.value("key");
+    QString newKey = context.parser.value("new-key");
+    if (QFileInfo(path).isDir()) {
+        return exitCode(context.crypto.rewrapDirectoryHybrid(path, oldKey, password(context), newKey));
+    }
+    return exitCode(context.crypto.rewrapFileHybrid(path, oldKey, password(context), newKey));
+}
+
+// Per-file results on stdout, the summary on stderr like every other command.
+// Results arrive from the worker threads, so writes to the stream are serialized.
+void printFileResults(CryptoManager &crypto)
+{
+    static QMutex outputMutex;
+    // Resolved here: the results are printed from pool threads
+    QTextStream *stream = &out();
+    QObject::connect(&crypto, &CryptoManager::fileVerified,
+                     [stream](const QString &file, bool ok, const QString &message) {
+                         QMutexLocker locker(&outputMutex);
+                         *stream << (ok ? "OK      " : "FAILED  ") << file << (ok ? QString() : ": " + message) << "\n";
+                         stream->flush();
+                     });
+}
+
+int verify(CliContext &context)
+{
+    printFileResults(context.crypto);
+    return exitCode(context.crypto.verifyFiles(context.args, context.parser.value("key"), password(context)));
+}
+
+int migrateXor(CliContext &context)
+{
+    // Like the password, the XOR key can stay out of ps output
+    QString xorKey = context.parser.isSet("xor-key") ? context.parser.value("xor-key")
+                                                     : qEnvironmentVariable("SAFE_XOR_KEY");
+    printFileResults(context.crypto);
+    return exitCode(context.crypto.migrateXorFiles(context.args, xorKey, password(context)));
+}
+
+// Candidates one per line, from a file or stdin; prints the 1-based line that matches
+int findPassword(CliContext &context)
+{
+    QString error;
+    QScopedPointer<QIODevice> list(StreamEndpoint::open(context.args[1], QIODevice::ReadOnly, error));
+    if (!list) {
+        err() << "error: " << error << "\n";
+        return kExitFailed;
+    }
+
+    QStringList candidates;
+    for (const QByteArray &line : list->readAll().split('\n')) {
+        candidates << QString::fromUtf8(line).remove('\r');
+    }
+    if (!candidates.isEmpty() && candidates.last().isEmpty()) {
+        candidates.removeLast();
+    }
+
+    int index = context.crypto.findPassword(context.args[0], candidates);
+    if (index >= 0) {
+        out() << index + 1 << "\n";
+    }
+    return exitCode(index >= 0);
+}
+
+int keysForFile(CliContext &context)
+{
+    QStringList keys = context.crypto.keysForFile(context.args[0]);
+    for (const QString &key : keys) {
+        out() << key << "\n";
+    }
+    return exitCode(!keys.isEmpty());
+}
+
+int manifest(CliContext &context)
+{
+    const QString &action = context.args[0];
+    const QString &manifestPath = context.args[1];
+    printFileResults(context.crypto);
+
+    if (action == "create") {
+        QStringList paths = context.args.mid(2);
+        if (paths.isEmpty()) {
+            paths << QFileInfo(manifestPath).absolutePath();
+        }
+        return exitCode(context.crypto.createManifest(paths, manifestPath));
+    }
+    if (action == "verify") {
+        return exitCode(context.crypto.verifyManifest(manifestPath));
+    }
+
+    err() << "Unknown manifest action: " << action << "\n";
+    return kExitUsage;
+}
+
+int createArchive(CliContext &context)
+{
+    return exitCode(context.crypto.createArchive(context.args[0], context.args[1], password(context)));
+}
+
+int listArchive(CliContext &context)
+{
+    QVariantList members = context.crypto.listArchive(context.args[0], password(context));
+    for (const QVariant &member : members) {
+        QVariantMap entry = member.toMap();
+        out() << QString("%1  %2\n").arg(entry.value("size").toLongLong(), 12).arg(entry.value("path").toString());
+    }
+    return exitCode(!members.isEmpty());
+}
+
+int extractArchive(CliContext &context)
+{
+    return exitCode(context.crypto.extractArchive(context.args[0], context.args[1], password(context), context.args.value(2)));
+}
+
+int queryCatalog(CliContext &context)
+{
+    const QString &query = context.args[0];
+    QString value = context.args.value(1);
+    FileCatalog &catalog = FileCatalog::instance();
+
+    if (query == "count") {
+        out() << catalog.count() << "\n";
+        return kExitOk;
+    }
+    if (value.isEmpty()) {
+        err() << "Usage: safe cli catalog <key|output|hash|prefix> <value>\n";
+        return kExitUsage;
+    }
+
+    QVariantList rows;
+    if (query == "key") {
+        rows = catalog.filesForKey(value);
+    } else if (query == "output") {
+        rows = catalog.findByOutput(value);
+    } else if (query == "hash") {
+        rows = catalog.findByHash(value);
+    } else if (query == "prefix") {
+        rows = catalog.findByPathPrefix(value);
+    } else {
+        err() << "Unknown catalog query: " << query << "\n";
+        return kExitUsage;
+    }
+
+    // One JSON object per line, easy to pipe into jq
+    for (const QVariant &row : rows) {
+        out() << QJsonDocument(QJsonObject::fromVariantMap(row.toMap())).toJson(QJsonDocument::Compact) << "\n";
+    }
+    return exitCode(!rows.isEmpty());
+}
+
+int listKeys(CliContext &context)
+{
+    for (const QString &key : context.crypto.getKeyList()) {
+        out() << key << "\n";
+    }
+    return kExitOk;
+}
+
+int calibrateKdf(CliContext &context)
+{
+    QString algorithm = context.args.size() > 1 ? context.args[1] : QString("pbkdf2-sha256");
+    int cost = context.crypto.calibrateKdf(context.args[0].toInt(), algorithm);
+    out() << context.crypto.kdfSettings() << "\n";
+    return exitCode(cost > 0);
+}
+
+int calibrateStorage(CliContext &context)
+{
+    bool ok = context.crypto.calibrateStorage(context.args[0]);
+    out() << context.crypto.storageSettings(context.args[0]) << "\n";
+    return exitCode(ok);
+}
+
+const Command kCommands[] = {
+    { "encrypt-aes", "<input> <output>  (--password or SAFE_PASSWORD)", 2, encryptAes, 0, 2 },
+    { "decrypt-aes", "<input> <output>  (--password or SAFE_PASSWORD)", 2, decryptAes, 0, 2 },
+    { "encrypt-hybrid", "<input> <output> --key <name>[,<name>...]", 2, encryptHybrid, 0, 2 },
+    { "decrypt-hybrid", "<input> <output> --key <name>  (--password or SAFE_PASSWORD)", 2, decryptHybrid, 0, 2 },
+    { "rewrap-hybrid", "<file|dir> --key <old> --new-key <new>  (--password or SAFE_PASSWORD)", 1, rewrapHybrid, 0, 1 },
+    { "verify", "<file|dir>... [--key <name>]  (--password or SAFE_PASSWORD)", 1, verify, 0, -1 },
+    { "migrate-xor", "<file|dir>... --xor-key <key>  (--password or SAFE_PASSWORD)", 1, migrateXor, 0, -1 },
+    { "manifest", "<create|verify> <manifest> [paths...]", 2, manifest, 1, -1 },
+    { "archive-create", "<dir> <archive>  (--password or SAFE_PASSWORD)", 2, createArchive, 0, 2 },
+    { "archive-list", "<archive>  (--password or SAFE_PASSWORD)", 1, listArchive, 0, 1 },
+    { "archive-extract", "<archive> <output-dir> [member]  (--password or SAFE_PASSWORD)", 2, extractArchive, 0, 2 },
+    { "keys", "", 0, listKeys, 0, 0 },
+    { "find-password", "<file> <candidates-file|->", 2, findPassword, 0, 2 },
+    { "keys-for", "<file>", 1, keysForFile, 0, 1 },
+    { "catalog", "<key|output|hash|prefix|count> [value]", 1, queryCatalog, 0, 0 },
+    { "calibrate-kdf", "<target-ms> [pbkdf2-sha256|scrypt]", 1, calibrateKdf, 0, 0 },
+    { "calibrate-storage", "<dir>", 1, calibrateStorage, 0, 1 },
+};
+
+QString commandHelp()
+{
+    QString help = "Commands:\n";
+    for (const Command &command : kCommands) {
+        help += QString("  %1 %2\n").arg(QString::fromLatin1(command.name), QString::fromLatin1(command.usage));
+    }
+    help += "\nEncrypt/decrypt inputs and outputs may be - (stdin/stdout), fd:N or unix:PATH to stream.\n";
+    help += "With --daemon, commands run in \"safe daemon\" when it is running (streams to - or fd:N stay local).\n";
+    return help;
+}
+
+void setupParser(QCommandLineParser &parser)
+{
+    parser.setApplicationDescription("SecureFileEncryption command line\n\n" + commandHelp());
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "Command to run");
+    parser.addPositionalArgument("args", "Command arguments", "[args...]");
+    for (const Option &option : kOptions) {
+        parser.addOption(QCommandLineOption(QString::fromLatin1(option.name), QString::fromLatin1(option.description),
+                                            option.valueName ? QString::fromLatin1(option.valueName) : QString()));
+    }
+}
+
+const Command *findCommand(const QString &name)
+{
+    for (const Command &candidate : kCommands) {
+        if (name == QLatin1String(candidate.name)) {
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+// The command line as the daemon must see it: paths made absolute against this
+// process's directory, and the secrets from the environment passed explicitly
+// (the daemon's environment is not the client's). False when the command has
+// to run here: unknown commands, and streams over this process's stdio or fds.
+bool daemonArguments(const QCommandLineParser &parser, QStringList &arguments)
+{
+    QStringList positional = parser.positionalArguments();
+    const Command *command = positional.isEmpty() ? nullptr : findCommand(positional.first());
+    if (!command) {
+        return false;
+    }
+
+    arguments.clear();
+    arguments << positional.takeFirst();
+    for (int i = 0; i < positional.size(); ++i) {
+        QString arg = positional[i];
+        bool isPath = i >= command->firstPath && (command->pathCount < 0 || i < command->firstPath + command->pathCount);
+        if (isPath && (arg == "-" || arg.startsWith("fd:"))) {
+            return false;
+        }
+        if (isPath && !StreamEndpoint::isStreamSpec(arg)) {
+            arg = QFileInfo(arg).absoluteFilePath();
+        }
+        arguments << arg;
+    }
+
+    for (const Option &option : kOptions) {
+        QString name = QString::fromLatin1(option.name);
+        if (!option.forwarded || !parser.isSet(name)) {
+            continue;
+        }
+        if (!option.valueName) {
+            arguments << "--" + name;
+            continue;
+        }
+        for (const QString &value : parser.values(name)) {
+            arguments << "--" + name << (option.isPath ? QFileInfo(value).absoluteFilePath() : value);
+        }
+    }
+
+    if (!parser.isSet("password") && qEnvironmentVariableIsSet("SAFE_PASSWORD")) {
+        arguments << "--password" << qEnvironmentVariable("SAFE_PASSWORD");
+    }
+    if (!parser.isSet("xor-key") && qEnvironmentVariableIsSet("SAFE_XOR_KEY")) {
+        arguments << "--xor-key" << qEnvironmentVariable("SAFE_XOR_KEY");
+    }
+    return true;
+}
+
+// Runs a parsed command. Embedded runs (in the daemon) leave process-wide
+// state alone: no signal handler and no change to the shared memory budget.
+int execute(const QCommandLineParser &parser, bool embedded, const std::function<void(CryptoManager *)> &attach)
+{
+    QStringList positional = parser.positionalArguments();
+    if (positional.isEmpty()) {
+        err() << parser.helpText();
+        return kExitUsage;
+    }
+
+    QString name = positional.takeFirst();
+    const Command *command = findCommand(name);
+    if (!command) {
+        err() << "Unknown command: " << name << "\n" << commandHelp();
+        return kExitUsage;
+    }
+    if (positional.size() < command->minArgs) {
+        err() << "Usage: safe cli " << command->name << " " << command->usage << "\n";
+        return kExitUsage;
+    }
+
+    // Only this command's spans, also when the daemon runs others alongside
+    std::shared_ptr<CryptoMetrics::Trace> trace;
+    if (parser.isSet("trace")) {
+        trace = std::make_shared<CryptoMetrics::Trace>();
+    }
+    CryptoMetrics::TraceScope traceScope(trace);
+
+    CryptoManager crypto;
+    if (parser.isSet("priority")) {
+        static const QStringList classes = { "interactive", "normal", "background" };
+        int priority = classes.indexOf(parser.value("priority").toLower());
+        if (priority < 0) {
+            err() << "Unknown priority: " << parser.value("priority") << "\n";
+            return kExitUsage;
+        }
+        crypto.setPriority(priority);
+    }
+    if (parser.isSet("cache")) {
+        static const QStringList modes = { "cached", "drop-behind", "direct" };
+        if (!modes.contains(parser.value("cache"))) {
+            err() << "Unknown cache mode: " << parser.value("cache") << "\n";
+            return kExitUsage;
+        }
+        crypto.setCacheMode(parser.value("cache"));
+    }
+    if (parser.isSet("memory-budget")) {
+        if (embedded) {
+            // One budget for everything the daemon runs
+            err() << "--memory-budget is ignored in the daemon\n";
+        } else {
+            // Not persisted, unlike setMemoryBudget
+            MemoryBudget::instance().setLimit(parser.value("memory-budget").toLongLong() << 20);
+        }
+    }
+    QTextStream *messages = &err();
+    QObject::connect(&crypto, &CryptoManager::operationComplete,
+                     [messages](bool success, const QString &message) {
+                         *messages << (success ? "" : "error: ") << message << "\n";
+                         messages->flush();
+                     });
+
+    // Hashes are collected during the command and written once at the end
+    if (parser.isSet("manifest")) {
+        crypto.beginManifest(parser.value("manifest"));
+    }
+
+    if (attach) {
+        attach(&crypto);
+    }
+    if (!embedded) {
+        runningCrypto = &crypto;
+        std::signal(SIGINT, cancelOnSignal);
+    }
+
+    CliContext context{ crypto, parser, positional };
+    int result = command->handler(context);
+
+    if (parser.isSet("manifest") && !crypto.endManifest() && result == kExitOk) {
+        result = kExitFailed;
+    }
+
+    if (!embedded) {
+        std::signal(SIGINT, SIG_DFL);
+        runningCrypto = nullptr;
+    }
+    if (attach) {
+        attach(nullptr);
+    }
+
+    if (parser.isSet("metrics")) {
+        // stdout may be carrying the data of a streaming command
+        QTextStream &metricsStream = positional.contains("-") ? err() : out();
+        metricsStream << QJsonDocument(CryptoMetrics::instance().toJson()).toJson(QJsonDocument::Indented);
+    }
+    if (trace && !trace->write(parser.value("trace"))) {
+        err() << "Failed to write trace file " << parser.value("trace") << "\n";
+    }
+
+    out().flush();
+    err().flush();
+    return result;
+}
+
+} // namespace
+
+int CryptoCli::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    setupParser(parser);
+
+    // process() expects the program name first; it exits on --help or bad options
+    parser.process(QStringList() << "safe cli" << arguments);
+
+    // Without a daemon listening, the command simply runs here
+    if (parser.isSet("daemon") || qEnvironmentVariableIsSet("SAFE_DAEMON")) {
+        QStringList forwarded;
+        int result = kExitOk;
+        if (daemonArguments(parser, forwarded) && CryptoDaemon::forward(forwarded, out(), err(), result)) {
+            return result;
+        }
+    }
+
+    return execute(parser, false, nullptr);
+}
+
+int CryptoCli::runEmbedded(const QStringList &arguments, QTextStream &output, QTextStream &errors,
+                           const std::function<void(CryptoManager *)> &attach)
+{
+    QTextStream *previousOut = commandOut;
+    QTextStream *previousErr = commandErr;
+    commandOut = &output;
+    commandErr = &errors;
+
+    int result = kExitUsage;
+    QCommandLineParser parser;
+    setupParser(parser);
+    if (!parser.parse(QStringList() << "safe cli" << arguments)) {
+        errors << parser.errorText() << "\n";
+    } else if (parser.isSet("help")) {
+        output << parser.helpText();
+        result = kExitOk;
+    } else {
+        result = execute(parser, true, attach);
+    }
+
+    output.flush();
+    errors.flush();
+    commandOut = previousOut;
+    commandErr = previousErr;
+    return result;
+}
@@ -0,0 +1,27 @@
+#ifndef CRYPTOCLI_H
+#define CRYPTOCLI_H
+
+#include <QStringList>
+#include <functional>
+
+class CryptoManager;
+class QTextStream;
+
+// 命令行模式
+// Started as "safe cli <command> [options] [args...]"; runs crypto operations
+// without the GUI so scripts and batch jobs can use the same engine.
+// Run "safe cli --help" for the list of commands.
+class CryptoCli
+{
+public:
+    // arguments excludes the program name and the "cli" marker
+    static int run(const QStringList &arguments);
+
+    // One command inside a long-running process (the daemon): output goes to
+    // the given streams, bad options are reported instead of exiting, and attach
+    // gets the command's CryptoManager while it runs (then nullptr) for cancelling
+    static int runEmbedded(const QStringList &arguments, QTextStream &output, QTextStream &errors,
+                           const std::function<void(CryptoManager *)> &attach);
+};
+
+#endif // CRYPTOCLI_H
@@ -0,0 +1,467 @@
+#include "CryptoDaemon.h"
+#include "CryptoCli.h"
+#include "CryptoManager.h"
+#include "CryptoService.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QTimer>
+
+#if defined(Q_OS_UNIX)
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+// State of one connection. started is only touched on the daemon's thread;
+// crypto and closed are shared with the thread running the command.
+struct CryptoDaemon::Session
+{
+    bool started = false;
+    QMutex mutex;
+    CryptoManager *crypto = nullptr;
+    bool closed = false;
+};
+
+namespace {
+
+// Sockets live on the daemon's thread: commands queue their writes to it. The
+// socket is only deleted by the last message of its command, so it outlives
+// every write queued before.
+void send(QLocalSocket *socket, const QJsonObject &message)
+{
+    QByteArray line = QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n';
+    QMetaObject::invokeMethod(socket, [socket, line]() {
+        if (socket->state() == QLocalSocket::ConnectedState) {
+            socket->write(line);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void finish(QLocalSocket *socket, int exitCode)
+{
+    QJsonObject message;
+    message.insert("exit", exitCode);
+    QByteArray line = QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n';
+    QMetaObject::invokeMethod(socket, [socket, line]() {
+        if (socket->state() != QLocalSocket::ConnectedState) {
+            socket->deleteLater();
+            return;
+        }
+        socket->write(line);
+        // Deleted once the reply has gone out
+        QObject::connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        socket->disconnectFromServer();
+    }, Qt::QueuedConnection);
+}
+
+#if defined(Q_OS_WIN)
+// TOKEN_USER of a process, empty on failure
+QByteArray processUser(HANDLE process)
+{
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(process, TOKEN_QUERY, &token)) {
+        return QByteArray();
+    }
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+    QByteArray user(int(size), 0);
+    bool ok = size > 0 && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+    CloseHandle(token);
+    return ok ? user : QByteArray();
+}
+
+bool isSameUser(ULONG processId)
+{
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+    if (!process) {
+        return false;
+    }
+    QByteArray peer = processUser(process);
+    CloseHandle(process);
+    QByteArray self = processUser(GetCurrentProcess());
+    return !peer.isEmpty() && !self.isEmpty()
+           && EqualSid(reinterpret_cast<TOKEN_USER*>(peer.data())->User.Sid,
+                       reinterpret_cast<TOKEN_USER*>(self.data())->User.Sid);
+}
+#endif
+
+// The process at the other end of a connected socket runs as this user.
+// Checked by both sides: commands carry passwords, and a name another user
+// got to first must neither receive them nor send commands.
+bool peerIsSameUser(QLocalSocket *socket, bool peerIsServer)
+{
+#if defined(Q_OS_LINUX)
+    Q_UNUSED(peerIsServer)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(int(socket->socketDescriptor()), SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0
+           && credentials.uid == geteuid();
+#elif defined(Q_OS_UNIX)
+    Q_UNUSED(peerIsServer)
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(int(socket->socketDescriptor()), &uid, &gid) == 0 && uid == geteuid();
+#elif defined(Q_OS_WIN)
+    HANDLE pipe = HANDLE(socket->socketDescriptor());
+    ULONG processId = 0;
+    BOOL ok = peerIsServer ? GetNamedPipeServerProcessId(pipe, &processId)
+                           : GetNamedPipeClientProcessId(pipe, &processId);
+    return ok && isSameUser(processId);
+#else
+    Q_UNUSED(socket)
+    Q_UNUSED(peerIsServer)
+    return false;
+#endif
+}
+
+#if defined(Q_OS_UNIX)
+// A directory only this user can enter: created 0700 if missing, and refused
+// if it is a symlink, belongs to someone else or is open to others
+bool privateDirectory(const QString &path)
+{
+    QByteArray native = QFile::encodeName(path);
+    if (mkdir(native.constData(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat info;
+    return lstat(native.constData(), &info) == 0 && S_ISDIR(info.st_mode) && info.st_uid == geteuid()
+           && (info.st_mode & 077) == 0;
+}
+#endif
+
+// Handles one message line of a command; true once it reported its exit code
+bool readMessage(const QByteArray &line, QTextStream &out, QTextStream &err, int &exitCode)
+{
+    QJsonObject message = QJsonDocument::fromJson(line).object();
+    if (message.contains("out")) {
+        out << message.value("out").toString();
+        out.flush();
+    } else if (message.contains("err")) {
+        err << message.value("err").toString();
+        err.flush();
+    } else if (message.contains("exit")) {
+        exitCode = message.value("exit").toInt();
+        return true;
+    }
+    return false;
+}
+
+// What a command writes to out()/err(), forwarded as {"out": ...} / {"err": ...}
+class CommandOutput : public QIODevice
+{
+public:
+    CommandOutput(QLocalSocket *socket, const QString &channel)
+        : m_socket(socket),
+          m_channel(channel)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        // QTextStream hands over whole encoded characters on every flush
+        QJsonObject message;
+        message.insert(m_channel, QString::fromUtf8(data, int(size)));
+        send(m_socket, message);
+        return size;
+    }
+
+private:
+    QLocalSocket *m_socket;
+    QString m_channel;
+};
+
+} // namespace
+
+CryptoDaemon::CryptoDaemon()
+{
+    m_commands.setMaxThreadCount(MaxCommands);
+    connect(&m_server, &QLocalServer::newConnection, this, &CryptoDaemon::acceptConnections);
+}
+
+QString CryptoDaemon::socketName()
+{
+    QString name = qEnvironmentVariable("SAFE_DAEMON_SOCKET");
+    if (!name.isEmpty()) {
+        return name;
+    }
+#if defined(Q_OS_UNIX)
+    // In a directory private to the user: $XDG_RUNTIME_DIR, else one of our
+    // own under the temp directory. Never a socket others could squat on.
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (directory.isEmpty() || !privateDirectory(directory)) {
+        directory = QDir::tempPath() + "/safe-crypto-" + QString::number(geteuid());
+        if (!privateDirectory(directory)) {
+            return QString();
+        }
+    }
+    return directory + "/safe-crypto.sock";
+#else
+    // Named pipes share one global namespace: both ends check the other's user
+    return "safe-crypto-" + qEnvironmentVariable("USERNAME", qEnvironmentVariable("USER"));
+#endif
+}
+
+int CryptoDaemon::run()
+{
+    QTextStream err(stderr);
+    CryptoDaemon daemon;
+    QString error;
+    if (!daemon.listen(error)) {
+        err << "error: " << error << "\n";
+        return 1;
+    }
+
+    // Warm before the first client: OpenSSL, the keys folder and key cache
+    CryptoService::instance();
+
+    err << "Listening on " << daemon.m_server.fullServerName() << "\n";
+    err.flush();
+    return QCoreApplication::exec();
+}
+
+bool CryptoDaemon::listen(QString &error)
+{
+    // Only this user can connect: commands carry passwords
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    const QString name = socketName();
+    if (name.isEmpty()) {
+        error = "No private directory for the daemon socket";
+        return false;
+    }
+    if (m_server.listen(name)) {
+        return true;
+    }
+
+    if (m_server.serverError() == QAbstractSocket::AddressInUseError) {
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if (probe.waitForConnected(ConnectTimeoutMs)) {
+            error = "A daemon is already listening on " + name;
+            return false;
+        }
+        // Left behind by a daemon that did not exit cleanly
+        QLocalServer::removeServer(name);
+        if (m_server.listen(name)) {
+            return true;
+        }
+    }
+
+    error = "Cannot listen on " + name + ": " + m_server.errorString();
+    return false;
+}
+
+void CryptoDaemon::acceptConnections()
+{
+    while (QLocalSocket *socket = m_server.nextPendingConnection()) {
+        if (!peerIsSameUser(socket, false)) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+        std::shared_ptr<Session> session = std::make_shared<Session>();
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket, session]() {
+            if (session->started) {
+                return;
+            }
+            if (!socket->canReadLine()) {
+                if (socket->bytesAvailable() > MaxRequestBytes) {
+                    socket->abort();
+                }
+                return;
+            }
+            session->started = true;
+            startCommand(socket, session);
+        });
+
+        // The client went away (or was interrupted): cancel what it started
+        connect(socket, &QLocalSocket::disconnected, this, [socket, session]() {
+            {
+                QMutexLocker locker(&session->mutex);
+                session->closed = true;
+                if (session->crypto) {
+                    session->crypto->cancelOperation();
+                }
+            }
+            if (!session->started) {
+                socket->deleteLater();
+            }
+        });
+    }
+}
+
+void CryptoDaemon::startCommand(QLocalSocket *socket, const std::shared_ptr<Session> &session)
+{
+    QJsonObject request = QJsonDocument::fromJson(socket->readLine(MaxRequestBytes)).object();
+    QStringList arguments;
+    for (const QJsonValue &value : request.value("args").toArray()) {
+        arguments << value.toString();
+    }
+
+    m_commands.start([socket, session, arguments]() {
+        CommandOutput outDevice(socket, "out");
+        CommandOutput errDevice(socket, "err");
+        QTextStream out(&outDevice);
+        QTextStream err(&errDevice);
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+        out.setCodec("UTF-8");
+        err.setCodec("UTF-8");
+#else
+        out.setEncoding(QStringConverter::Utf8);
+        err.setEncoding(QStringConverter::Utf8);
+#endif
+
+        int result = 2;
+        bool closed;
+        {
+            QMutexLocker locker(&session->mutex);
+            closed = session->closed;
+        }
+        if (arguments.isEmpty()) {
+            err << "error: empty request\n";
+        } else if (!closed) {
+            result = CryptoCli::runEmbedded(arguments, out, err, [session](CryptoManager *crypto) {
+                QMutexLocker locker(&session->mutex);
+                session->crypto = crypto;
+            });
+        }
+        out.flush();
+        err.flush();
+        finish(socket, result);
+    });
+}
+
+bool CryptoDaemon::forward(const QStringList &arguments, QTextStream &out, QTextStream &err, int &exitCode)
+{
+    const QString name = socketName();
+    if (name.isEmpty()) {
+        return false;
+    }
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    if (!socket.waitForConnected(ConnectTimeoutMs)) {
+        return false;
+    }
+    if (!peerIsSameUser(&socket, true)) {
+        err << "warning: " << name << " is served by another user; running locally\n";
+        err.flush();
+        return false;
+    }
+
+    QJsonObject request;
+    request.insert("args", QJsonArray::fromStringList(arguments));
+    socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+
+    // From here on the command belongs to the daemon; Ctrl+C ends this
+    // process, which closes the socket and cancels it there
+    for (;;) {
+        while (socket.canReadLine()) {
+            if (readMessage(socket.readLine(), out, err, exitCode)) {
+                return true;
+            }
+        }
+        if (!socket.waitForReadyRead(-1) && !socket.canReadLine()) {
+            break;
+        }
+    }
+
+    err << "error: the daemon closed the connection\n";
+    err.flush();
+    exitCode = 1;
+    return true;
+}
+
+// State of one submit(): output collected until the exit message
+struct CryptoDaemon::Submission
+{
+    QString output;
+    QString errors;
+    QTextStream out{&output};
+    QTextStream err{&errors};
+    bool sent = false;
+    bool done = false;
+};
+
+void CryptoDaemon::submit(const QStringList &arguments, QObject *context, const SubmitCallback &callback)
+{
+    // No thread waits on the daemon: the socket is driven by context's event loop
+    std::shared_ptr<Submission> submission = std::make_shared<Submission>();
+    QLocalSocket *socket = new QLocalSocket(context);
+
+    auto complete = [socket, submission, callback](bool reached, int exitCode) {
+        if (submission->done) {
+            return;
+        }
+        submission->done = true;
+        submission->out.flush();
+        submission->err.flush();
+        socket->disconnect();
+        socket->abort();
+        socket->deleteLater();
+        callback(reached, exitCode, submission->output, submission->errors);
+    };
+
+    QObject::connect(socket, &QLocalSocket::connected, socket, [socket, submission, arguments, complete]() {
+        if (!peerIsSameUser(socket, true)) {
+            complete(false, 1);
+            return;
+        }
+        QJsonObject request;
+        request.insert("args", QJsonArray::fromStringList(arguments));
+        socket->write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+        submission->sent = true;
+    });
+    QObject::connect(socket, &QLocalSocket::readyRead, socket, [socket, submission, complete]() {
+        int exitCode = 1;
+        while (!submission->done && socket->canReadLine()) {
+            if (readMessage(socket->readLine(), submission->out, submission->err, exitCode)) {
+                complete(true, exitCode);
+            }
+        }
+    });
+    QObject::connect(socket, &QLocalSocket::disconnected, socket, [submission, complete]() {
+        if (submission->sent) {
+            submission->err << "error: the daemon closed the connection\n";
+        }
+        complete(submission->sent, 1);
+    });
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    const auto socketError = &QLocalSocket::errorOccurred;
+#else
+    const auto socketError = QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error);
+#endif
+    QObject::connect(socket, socketError, socket, [submission, complete]() {
+        if (!submission->sent) {
+            complete(false, 1);
+        }
+    });
+    QTimer::singleShot(ConnectTimeoutMs, socket, [socket, complete]() {
+        if (socket->state() != QLocalSocket::ConnectedState) {
+            complete(false, 1);
+        }
+    });
+
+    const QString name = socketName();
+    if (name.isEmpty()) {
+        complete(false, 1);
+        return;
+    }
+    socket->connectToServer(name);
+}
@@ -0,0 +1,70 @@
+#ifndef CRYPTODAEMON_H
+#define CRYPTODAEMON_H
+
+#include <QLocalServer>
+#include <QObject>
+#include <QThreadPool>
+#include <functional>
+#include <memory>
+
+class QLocalSocket;
+class QTextStream;
+
+// 后台加密守护进程
+// "safe daemon" keeps one process running with everything a short-lived CLI
+// run pays for again each time: OpenSSL initialisation, parsed key files, the
+// password-derived master keys, the catalog connection and the scheduler
+// pools. "safe cli --daemon ..." (or SAFE_DAEMON=1) and the GUI hand commands
+// to it, so they start warm and share one machine-wide schedule.
+//
+// Protocol, over a local socket that only the owning user can open (both ends
+// also check that the peer process runs as the same user), one command per
+// connection, JSON lines:
+//   client -> {"args": ["encrypt-aes", "/abs/in", "/abs/out", "--password", "..."]}
+//   daemon -> {"out": "..."} / {"err": "..."}   as the command writes
+//   daemon -> {"exit": 0}                       when it is done
+// Closing the connection cancels the command.
+class CryptoDaemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Serve until killed; returns an exit code when the socket cannot be set up
+    static int run();
+
+    // SAFE_DAEMON_SOCKET, else a socket in a directory private to the user
+    // (the runtime directory, or a 0700 one under the temp directory); empty
+    // when no such directory can be had. On Windows a named pipe per user.
+    static QString socketName();
+
+    // Run a CLI command line in the daemon, copying its output to out and err.
+    // False when no daemon answers, or it runs as another user (nothing was
+    // sent: run the command locally).
+    static bool forward(const QStringList &arguments, QTextStream &out, QTextStream &err, int &exitCode);
+
+    // forward() without blocking a thread, for event-loop threads (the GUI):
+    // callback runs on context's thread once the command finished, with
+    // reached false if no daemon of this user answered
+    using SubmitCallback = std::function<void(bool reached, int exitCode, const QString &output, const QString &errors)>;
+    static void submit(const QStringList &arguments, QObject *context, const SubmitCallback &callback);
+
+    static const int ConnectTimeoutMs = 1000;
+    // Commands in progress at once; each mostly waits on the scheduler pools
+    static const int MaxCommands = 16;
+    static const int MaxRequestBytes = 1024 * 1024;
+
+private:
+    CryptoDaemon();
+
+    struct Session;
+    struct Submission;
+
+    bool listen(QString &error);
+    void acceptConnections();
+    void startCommand(QLocalSocket *socket, const std::shared_ptr<Session> &session);
+
+    QLocalServer m_server;
+    QThreadPool m_commands;
+};
+
+#endif // CRYPTODAEMON_H
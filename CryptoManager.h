@@ -12,11 +12,26 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QIODevice>
+#include <QVariantList>
+#include <functional>
+#include <QScopedPointer>
+#include "ContentManifest.h"
+#include "JobControl.h"
+#include "JobScheduler.h"
+#include "KdfParams.h"
+#include "PageCacheAdvisor.h"
 
 // 定义RSA加密的最大数据大小（字节）
 // 对于2048位RSA密钥使用PKCS#1填充，最大为245字节
 #define RSA_MAX_SIZE 245
 
+// 混合加密文件头中RSA加密后AES密钥的最大长度（支持到4096位RSA）
+#define HYBRID_MAX_WRAPPED_KEY_SIZE 512
+
+// 多接收者混合加密文件中允许的最大接收者数量
+#define HYBRID_MAX_RECIPIENTS 256
+
 class CryptoManager : public QObject
 {
     Q_OBJECT
@@ -31,6 +46,20 @@ public:
     Q_INVOKABLE bool exportKey(const QString &keyName, const QString &exportPath, const QString &password);
     Q_INVOKABLE bool importKey(const QString &importPath, const QString &password);
 
+    // Pick KDF parameters that take about targetMilliseconds on this machine and
+    // use them for new files and keys; returns the chosen cost
+    Q_INVOKABLE int calibrateKdf(int targetMilliseconds, const QString &algorithm = "pbkdf2-sha256");
+    Q_INVOKABLE QString kdfSettings();
+
+    // Measure chunk size and queue depth for the mount holding directory (see
+    // StorageTuner); file streams and batches on that mount use them from then on
+    Q_INVOKABLE bool calibrateStorage(const QString &directory);
+    Q_INVOKABLE QString storageSettings(const QString &path);
+    // Calibrate unknown mounts in the background as work reaches them; each
+    // probe writes a 64 MiB scratch file next to the data. Persisted, off by default
+    Q_INVOKABLE void setStorageAutoCalibrate(bool enabled);
+    Q_INVOKABLE bool storageAutoCalibrate() const;
+
     // AES encryption/decryption
     Q_INVOKABLE bool encryptFileAES(const QString &inputFile, const QString &outputFile, const QString &password);
     Q_INVOKABLE bool decryptFileAES(const QString &inputFile, const QString &outputFile, const QString &password);
@@ -43,22 +72,151 @@ public:
     Q_INVOKABLE bool encryptFileHybrid(const QString &inputFile, const QString &outputFile, const QString &keyName);
     Q_INVOKABLE bool decryptFileHybrid(const QString &inputFile, const QString &outputFile, const QString &keyName, const QString &password);
 
+    // Multi-recipient hybrid: the payload is encrypted once, the content key is
+    // wrapped for every listed RSA key; any of them can decrypt with decryptFileHybrid
+    Q_INVOKABLE bool encryptFileHybridMulti(const QString &inputFile, const QString &outputFile, const QStringList &keyNames);
+
+    // Streaming variants: the same formats, between any devices (pipes, sockets,
+    // stdin/stdout; see StreamEndpoint), so nothing is staged on disk and memory
+    // stays at the chunk buffers. in and out must be open. Sequential sinks
+    // cannot be rolled back: on failure out holds partial data. Empty input
+    // gives a regular (padding-only) payload and nothing goes to the catalog.
+    bool encryptStream(QIODevice *in, QIODevice *out, const QString &password);
+    bool decryptStream(QIODevice *in, QIODevice *out, const QString &password);
+    bool encryptStreamHybrid(QIODevice *in, QIODevice *out, const QStringList &keyNames);
+    bool decryptStreamHybrid(QIODevice *in, QIODevice *out, const QString &keyName, const QString &password);
+
+    // Key rotation: unwrap the content key with the old private key and wrap it for
+    // the new key. The payload is never re-encrypted: a header of unchanged size is
+    // overwritten in place (journaled to "<file>.rewrap" until it is synced, and
+    // rolled back by the next rotation if interrupted); only a header that changes
+    // size is written to a replacement file with the payload copied behind it.
+    // The directory variant walks *.enc recursively and processes files in
+    // parallel; files not encrypted for oldKeyName are skipped.
+    Q_INVOKABLE bool rewrapFileHybrid(const QString &file, const QString &oldKeyName, const QString &password, const QString &newKeyName);
+    Q_INVOKABLE bool rewrapDirectoryHybrid(const QString &directory, const QString &oldKeyName, const QString &password, const QString &newKeyName);
+
+    // Migrate legacy XOR files (DirectoryHandler::enCodeFile) to AES in one pass
+    // each: the XOR layer is removed while reading, straight into the AES stream.
+    // "name.xor" becomes "name.aes"; the new file is decrypted back and compared
+    // with the plaintext hash, then the legacy file is renamed to "name.xor.bak".
+    // The XOR key cannot be verified (the format has no check value): a wrong key
+    // produces a valid .aes of garbage, so check the results before deleting the
+    // backups. Directories are searched for *.xor, files run in parallel and
+    // report through fileVerified.
+    Q_INVOKABLE bool migrateXorFiles(const QStringList &paths, const QString &xorKey, const QString &password);
+
+    // Verify-only: decrypt to a discarding sink and compare the plaintext hash with
+    // the catalog, without writing anything. Empty keyName means password (AES) mode;
+    // otherwise .rsa files use RSA and everything else hybrid. Directories are
+    // searched for *.aes/*.enc/*.rsa and all files are checked in parallel.
+    Q_INVOKABLE bool verifyFile(const QString &file, const QString &keyName, const QString &password);
+    Q_INVOKABLE bool verifyFiles(const QStringList &paths, const QString &keyName, const QString &password);
+
+    // Key search from headers only, nothing is decrypted. findPassword returns the
+    // index of the candidate that opens a password-encrypted file, or -1; master
+    // keys are cached, so a list tried against many files of one session runs
+    // each KDF once. keysForFile lists the key pairs a hybrid file was encrypted
+    // for (multi-recipient headers; older single-recipient files carry no key ids).
+    Q_INVOKABLE int findPassword(const QString &file, const QStringList &candidates);
+    Q_INVOKABLE QStringList keysForFile(const QString &file);
+
+    // Keys for decrypting many files: the password, or the key pair with the
+    // private key unlocked once (empty keyName means password mode)
+    struct DecryptionKeys
+    {
+        QString password;
+        QByteArray publicKey;
+        QByteArray privateKey; // unlocked PEM, empty in password mode
+    };
+    bool unlockDecryptionKeys(const QString &keyName, const QString &password, DecryptionKeys &keys, QString &error);
+
+    // Decrypt any of the file formats (AES, hybrid, RSA, empty markers) into out,
+    // with the plaintext SHA-256 in contentHash. Writes nothing else and emits
+    // no signals, so it is safe to run from worker threads.
+    bool decryptToDevice(const QString &path, const DecryptionKeys &keys, QIODevice *out, QByteArray &contentHash,
+                         QString &error);
+
+    // KDF parameters for new password-derived keys (set by calibrateKdf)
+    static KdfParams currentKdfParams();
+
+    // Checksum manifests (sha256sum format). createManifest hashes every file
+    // under paths on the worker pool; verifyManifest re-hashes the listed files
+    // and reports each one through fileVerified.
+    Q_INVOKABLE bool createManifest(const QStringList &paths, const QString &manifestPath);
+    Q_INVOKABLE bool verifyManifest(const QString &manifestPath);
+
+    // Between begin and end, every successful encrypt/decrypt adds its source
+    // and output to the manifest. The plaintext side reuses the hash computed
+    // while encrypting, so the source is not read a second time.
+    Q_INVOKABLE void beginManifest(const QString &manifestPath);
+    Q_INVOKABLE bool endManifest();
+
+    // Encrypted directory archives (see EncryptedArchive): one KDF for the whole
+    // tree, listing from the index, and single-member extraction when member is set
+    Q_INVOKABLE bool createArchive(const QString &directory, const QString &archivePath, const QString &password);
+    Q_INVOKABLE QVariantList listArchive(const QString &archivePath, const QString &password);
+    Q_INVOKABLE bool extractArchive(const QString &archivePath, const QString &outputDirectory, const QString &password,
+                                    const QString &member = QString());
+
+    // Job control, callable from any thread while an operation runs; a cancel
+    // issued just before an operation starts applies to it. Encrypting a large
+    // file with a password (ResumableSize and up) writes "<output>.part" with
+    // durable checkpoints; running the same encryption again with the same
+    // password after a cancel or crash continues from the last checkpoint.
+    // discardCheckpoint drops that state.
+    Q_INVOKABLE void cancelOperation();
+    Q_INVOKABLE void pauseOperation();
+    Q_INVOKABLE void resumeOperation();
+    Q_INVOKABLE bool isPaused() const;
+    Q_INVOKABLE void discardCheckpoint(const QString &outputFile);
+
+    // Scheduling class for this manager's work (JobScheduler::Priority).
+    // -1 (default): single-file calls run at the calling thread's class
+    // (Interactive on the GUI thread) and batches at Normal.
+    Q_INVOKABLE void setPriority(int priority);
+    Q_INVOKABLE int priority() const;
+
+    // Memory budget for in-flight crypto work across all managers (see
+    // MemoryBudget); persisted, 0 restores the default
+    Q_INVOKABLE void setMemoryBudget(int megabytes);
+    Q_INVOKABLE int memoryBudget() const;
+
+    // Page cache use of file streams (see PageCacheAdvisor): "cached" (default),
+    // "drop-behind" for bulk jobs that must not evict other services' data,
+    // or "direct" to also read sources with O_DIRECT
+    Q_INVOKABLE void setCacheMode(const QString &mode);
+    Q_INVOKABLE QString cacheMode() const;
+
+    static const qint64 ResumableSize = qint64(1) << 30;
+    static const qint64 CheckpointInterval = qint64(256) << 20;
+
     // File operations
     Q_INVOKABLE void listFiles(const QString &directoryPath, const QStringList &suffixes);
 
+    // Hot-path metrics (per-phase/per-operation timing, bytes, peak memory)
+    Q_INVOKABLE QString metricsJson();
+    Q_INVOKABLE void resetMetrics();
+    Q_INVOKABLE void setTraceEnabled(bool enabled);
+    Q_INVOKABLE bool dumpTrace(const QString &path);
+
 signals:
+    // Per-file result of verifyFiles and the manifest calls, emitted from worker threads
+    void fileVerified(const QString &file, bool ok, const QString &message);
     void fileNameSignal(const QString &name, const int &time);
     void operationComplete(bool success, const QString &message);
     void progressUpdate(int percentage);
 
 private:
     // Private helper methods
-    QByteArray generateAESKey(const QString &password, const QByteArray &salt);
-    QByteArray generateRandomBytes(int length);
+    QByteArray generateAESKey(const QString &password, const QByteArray &salt, const KdfParams &params = KdfParams::legacy());
+    // Empty / false when the RNG fails: the bytes must not be used then
+    Q_REQUIRED_RESULT QByteArray generateRandomBytes(int length);
+    Q_REQUIRED_RESULT bool generateRandomBytes(unsigned char *buffer, int length);
     bool saveKeyToFile(const QString &keyName, const QByteArray &publicKey, const QByteArray &encryptedPrivateKey);
-    bool saveAESKeyToFile(const QString &keyName, const QByteArray &encryptedKey, const QByteArray &salt);
+    bool saveAESKeyToFile(const QString &keyName, const QByteArray &encryptedKey, const QByteArray &salt, const KdfParams &params);
     bool loadKeyFromFile(const QString &keyName, QByteArray &publicKey, QByteArray &encryptedPrivateKey);
-    bool loadAESKeyFromFile(const QString &keyName, QByteArray &encryptedKey, QByteArray &salt);
+    bool loadAESKeyFromFile(const QString &keyName, QByteArray &encryptedKey, QByteArray &salt, KdfParams *params = nullptr);
     QString getKeysFolderPath();
 
     // Encryption helpers
@@ -66,6 +224,120 @@ private:
     QByteArray aesDecrypt(const QByteArray &data, const QByteArray &key, const QByteArray &iv);
     QByteArray rsaEncrypt(const QByteArray &data, const QByteArray &publicKey);
     QByteArray rsaDecrypt(const QByteArray &data, const QByteArray &privateKey);
+
+    // Password-mode header (KDF params + salt + IV); legacy headers read as PBKDF2/10000
+    QByteArray encodeAesHeader(const KdfParams &params, const unsigned char *salt, const unsigned char *iv);
+    bool readAesHeader(QIODevice *in, KdfParams &params, unsigned char *salt, unsigned char *iv);
+    // Same, with the first four bytes already consumed (sources that cannot seek)
+    bool readAesHeader(QIODevice *in, const char *magic, KdfParams &params, unsigned char *salt, unsigned char *iv);
+
+    // Batch password format "SFEB": one KDF per session gives a master key (cached
+    // in CryptoService), every file gets its own key from HKDF(master, nonce).
+    // readPasswordFileKey reads either header layout and returns the file key;
+    // newPasswordFileKey makes a fresh file key, IV and the header to write.
+    QByteArray encodeBatchHeader(const KdfParams &params, const unsigned char *salt, const unsigned char *nonce, const unsigned char *iv,
+                                 const QByteArray &keyCheck);
+    static QByteArray keyCheckValue(const QByteArray &key);
+    QByteArray newPasswordFileKey(const QString &password, QByteArray &header, unsigned char *iv, QString &error);
+    QByteArray readPasswordFileKey(QIODevice *in, const QString &password, unsigned char *iv, QString &error);
+    QByteArray sessionMasterKey(const QString &password, KdfParams &params, unsigned char *salt);
+    QByteArray batchMasterKey(const QString &password, const KdfParams &params, const unsigned char *salt);
+    static QByteArray fileSubkey(const QByteArray &masterKey, const unsigned char *nonce);
+
+    // Wrong-key check from the end of a seekable CBC payload (starting at the
+    // current position, which is kept): false when the last block does not
+    // decrypt to valid padding. True for sequential devices.
+    bool finalBlockPadded(QIODevice *in, const QByteArray &key, const unsigned char *iv);
+
+    // RSA key helpers: key id (SHA-256 of the public key) and password-protected private key unlock
+    static QByteArray keyId(const QByteArray &publicKey);
+    QByteArray unlockPrivateKey(const QByteArray &encryptedPrivateKey, const QString &password, QString &error);
+
+    // Hybrid headers: multi-recipient "SFEH" or the single-recipient KEY_SIZE layout.
+    // keyIds is empty for the single-recipient layout; size counts the bytes before the IV.
+    struct HybridHeader
+    {
+        QList<QByteArray> keyIds;
+        QList<QByteArray> wrappedKeys;
+        unsigned char iv[16];
+        qint64 size = 0;
+    };
+    QByteArray encodeHybridHeader(const QList<QByteArray> &keyIds, const QList<QByteArray> &wrappedKeys);
+    bool parseHybridHeader(QIODevice *in, HybridHeader &header);
+    bool readHybridHeader(QIODevice *in, const QByteArray &ownKeyId, QByteArray &wrappedKey, unsigned char *iv, QString &error);
+
+    // Content key of a hybrid payload: a fresh one wrapped for every public key
+    // (header is the "SFEH" header, the IV follows it), or the one unwrapped
+    // from a header with the password-protected private key
+    QByteArray newHybridContentKey(const QList<QByteArray> &publicKeys, QByteArray &header, unsigned char *iv, QString &error);
+    QByteArray readHybridContentKey(QIODevice *in, const QByteArray &publicKey, const QByteArray &encryptedPrivateKey,
+                                    const QString &password, unsigned char *iv, QString &error);
+
+    // Key rotation; rewrapHeader is safe to run from worker threads
+    enum RewrapResult {
+        Rewrapped,
+        RewrapSkipped,
+        RewrapFailed
+    };
+    bool rewrapFiles(const QStringList &files, const QString &oldKeyName, const QString &password, const QString &newKeyName);
+    // Run task for every file on a scheduler pool, with one aggregated progress.
+    // readsFiles: the task streams each file in full, so the batch's throughput
+    // can tune the storage queue depth (not so for header-only rewraps)
+    void runOnWorkers(const QStringList &files, const std::function<void(const QString &)> &task,
+                      JobScheduler::Resource resource = JobScheduler::Cpu, bool readsFiles = true);
+
+    JobScheduler::Priority operationPriority() const;
+    JobScheduler::Priority batchPriority() const;
+
+    // Verification; verifyOne is safe to run from worker threads
+    bool verifyOne(const QString &path, const DecryptionKeys &keys, QString &error);
+    bool migrateXorFile(const QString &file, const QByteArray &xorKey, const QString &password,
+                        QString &outputFile, QString &error);
+
+    // Undo a same-size header rewrite that a crash interrupted (see rewrapHeader)
+    bool recoverRewrap(const QString &path, QString &error);
+    RewrapResult rewrapHeader(const QString &path, const QByteArray &oldKeyId, const QByteArray &privateKey,
+                              const QByteArray &newPublicKey, QString &error);
+
+    // Called every CheckpointInterval bytes while encrypting, with the input
+    // offset and the last ciphertext block; returning false aborts the stream
+    typedef std::function<bool(qint64 inputOffset, const unsigned char *lastBlock)> CheckpointCallback;
+
+    // Streaming AES-256-CBC from in to out using pooled chunk buffers.
+    // plainDigest, if given, receives the SHA-256 of the plaintext from the same pass;
+    // cipherDigest that of the whole ciphertext file: cipherPrefix (the header the
+    // caller wrote) when encrypting, the bytes of in before its position when decrypting.
+    // Stops early (returns false) when the job is cancelled, and waits while it is paused.
+    bool aesStream(QIODevice *in, QIODevice *out, const unsigned char *key, const unsigned char *iv, bool encrypt,
+                   QByteArray *plainDigest = nullptr, bool reportProgress = true,
+                   const CheckpointCallback &checkpoint = CheckpointCallback(),
+                   QByteArray *cipherDigest = nullptr, const QByteArray &cipherPrefix = QByteArray());
+
+    // Resumable encryption into "<output>.part". header is written for a new job
+    // and empty when continuing from checkpoint. contentHash stays empty for a
+    // resumed job (the SHA-256 state of the first run is gone).
+    bool findCheckpoint(const QFile &inFile, const QString &outputFile, const char *method,
+                        const QStringList &keyNames, JobCheckpoint &checkpoint);
+    JobCheckpoint newCheckpoint(const QFile &inFile, const char *method, const QStringList &keyNames,
+                                const unsigned char *iv);
+    bool runResumable(QFile &inFile, const QString &outputFile, JobCheckpoint &checkpoint, const QByteArray &header,
+                      const QByteArray &key, QByteArray &contentHash, QString &error);
+
+    // Message for a failed stream: cancellation wins over the generic failure
+    QString streamError(const QString &message) const;
+
+    // Record a finished file operation in the FileCatalog and the open manifest.
+    // Without cipherHash the manifest hashes the ciphertext file again.
+    void recordOperation(const char *operation, const char *method, const QString &inputFile, const QString &outputFile,
+                         const QStringList &keyNames, const QByteArray &contentHash,
+                         const QByteArray &cipherHash = QByteArray());
+
+    QScopedPointer<ContentManifest> m_manifest;
+    QString m_manifestPath;
+
+    JobControl m_job;
+    int m_priority = -1;
+    PageCacheAdvisor::Mode m_cacheMode = PageCacheAdvisor::Cached;
 };
 
 #endif // CRYPTOMANAGER_H
@@ -0,0 +1,275 @@
+#include "CryptoMetrics.h"
+#include "MemoryBudget.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+thread_local std::shared_ptr<CryptoMetrics::Trace> threadTrace;
+
+} // namespace
+
+CryptoMetrics &CryptoMetrics::instance()
+{
+    static CryptoMetrics metrics;
+    return metrics;
+}
+
+CryptoMetrics::CryptoMetrics()
+{
+    m_clock.start();
+}
+
+const char *CryptoMetrics::phaseName(Phase phase)
+{
+    switch (phase) {
+    case Kdf:
+        return "kdf";
+    case KeyLoad:
+        return "key_load";
+    case Read:
+        return "read";
+    case Cipher:
+        return "cipher";
+    case Write:
+        return "write";
+    default:
+        return "unknown";
+    }
+}
+
+CryptoMetrics::PhaseTimer::PhaseTimer(Phase phase, qint64 bytes)
+    : m_phase(phase), m_bytes(bytes), m_start(CryptoMetrics::instance().now())
+{
+}
+
+CryptoMetrics::PhaseTimer::~PhaseTimer()
+{
+    CryptoMetrics &metrics = CryptoMetrics::instance();
+    metrics.recordPhase(m_phase, m_start, metrics.now() - m_start, m_bytes);
+}
+
+CryptoMetrics::OperationTimer::OperationTimer(const char *operation)
+    : m_operation(operation), m_bytes(0), m_start(CryptoMetrics::instance().now()), m_succeeded(false)
+{
+}
+
+CryptoMetrics::OperationTimer::~OperationTimer()
+{
+    CryptoMetrics &metrics = CryptoMetrics::instance();
+    metrics.recordOperation(m_operation, m_start, metrics.now() - m_start, m_bytes, m_succeeded);
+}
+
+void CryptoMetrics::recordPhase(Phase phase, qint64 startNs, qint64 durationNs, qint64 bytes)
+{
+    Counter &counter = m_phases[phase];
+    counter.count.fetch_add(1, std::memory_order_relaxed);
+    counter.nanos.fetch_add(durationNs, std::memory_order_relaxed);
+    counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if (isTraceEnabled() || threadTrace) {
+        addTraceEvent(phaseName(phase), "phase", startNs, durationNs, bytes);
+    }
+}
+
+void CryptoMetrics::recordOperation(const char *operation, qint64 startNs, qint64 durationNs, qint64 bytes, bool succeeded)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        OperationStats &stats = m_operations[QString::fromLatin1(operation)];
+        ++stats.count;
+        if (!succeeded) {
+            ++stats.failures;
+        }
+        stats.nanos += durationNs;
+        stats.maxNanos = qMax(stats.maxNanos, durationNs);
+        stats.bytes += bytes;
+    }
+
+    if (isTraceEnabled() || threadTrace) {
+        addTraceEvent(operation, "operation", startNs, durationNs, bytes);
+    }
+
+    updatePeakMemory();
+}
+
+void CryptoMetrics::updatePeakMemory()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MACOS
+        qint64 peakKb = usage.ru_maxrss / 1024; // bytes on macOS
+#else
+        qint64 peakKb = usage.ru_maxrss;
+#endif
+        qint64 previous = m_peakRssKb.load(std::memory_order_relaxed);
+        while (peakKb > previous
+               && !m_peakRssKb.compare_exchange_weak(previous, peakKb, std::memory_order_relaxed)) {
+        }
+    }
+#endif
+}
+
+void CryptoMetrics::addTraceEvent(const char *name, const char *category, qint64 startNs, qint64 durationNs, qint64 bytes)
+{
+    Trace::Event event;
+    event.name = name;
+    event.category = category;
+    event.startNs = startNs;
+    event.durationNs = durationNs;
+    event.bytes = bytes;
+    event.threadId = quint64(quintptr(QThread::currentThreadId()));
+
+    if (isTraceEnabled()) {
+        m_trace.append(event);
+    }
+    if (threadTrace) {
+        threadTrace->append(event);
+    }
+}
+
+std::shared_ptr<CryptoMetrics::Trace> CryptoMetrics::currentTrace()
+{
+    return threadTrace;
+}
+
+CryptoMetrics::TraceScope::TraceScope(const std::shared_ptr<Trace> &trace)
+    : m_previous(threadTrace)
+{
+    threadTrace = trace;
+}
+
+CryptoMetrics::TraceScope::~TraceScope()
+{
+    threadTrace = m_previous;
+}
+
+void CryptoMetrics::Trace::append(const Event &event)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_events.size() < MaxTraceEvents) {
+        m_events.append(event);
+    }
+}
+
+void CryptoMetrics::Trace::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_events.clear();
+}
+
+QJsonObject CryptoMetrics::toJson() const
+{
+    QJsonObject phases;
+    for (int i = 0; i < PhaseCount; ++i) {
+        const Counter &counter = m_phases[i];
+        qint64 nanos = counter.nanos.load(std::memory_order_relaxed);
+        qint64 bytes = counter.bytes.load(std::memory_order_relaxed);
+
+        QJsonObject phase;
+        phase["count"] = counter.count.load(std::memory_order_relaxed);
+        phase["total_ms"] = nanos / 1e6;
+        phase["bytes"] = bytes;
+        if (nanos > 0 && bytes > 0) {
+            phase["mib_per_s"] = (bytes / 1048576.0) / (nanos / 1e9);
+        }
+        phases[phaseName(Phase(i))] = phase;
+    }
+
+    QJsonObject operations;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_operations.constBegin(); it != m_operations.constEnd(); ++it) {
+            const OperationStats &stats = it.value();
+            QJsonObject operation;
+            operation["count"] = stats.count;
+            operation["failures"] = stats.failures;
+            operation["total_ms"] = stats.nanos / 1e6;
+            operation["max_ms"] = stats.maxNanos / 1e6;
+            operation["mean_ms"] = stats.count > 0 ? stats.nanos / 1e6 / stats.count : 0.0;
+            operation["bytes"] = stats.bytes;
+            operations[it.key()] = operation;
+        }
+    }
+
+    QJsonObject result;
+    result["phases"] = phases;
+    result["operations"] = operations;
+    result["peak_rss_kb"] = m_peakRssKb.load(std::memory_order_relaxed);
+    result["memory_budget"] = MemoryBudget::instance().limit();
+    result["memory_budget_peak"] = MemoryBudget::instance().peak();
+    result["uptime_ms"] = now() / 1e6;
+    result["trace_enabled"] = isTraceEnabled();
+    return result;
+}
+
+void CryptoMetrics::reset()
+{
+    for (int i = 0; i < PhaseCount; ++i) {
+        m_phases[i].count = 0;
+        m_phases[i].nanos = 0;
+        m_phases[i].bytes = 0;
+    }
+    m_peakRssKb = 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_operations.clear();
+    }
+
+    m_trace.clear();
+}
+
+void CryptoMetrics::setTraceEnabled(bool enabled)
+{
+    m_traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool CryptoMetrics::writeTrace(const QString &path) const
+{
+    return m_trace.write(path);
+}
+
+bool CryptoMetrics::Trace::write(const QString &path) const
+{
+    QJsonArray events;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const Event &event : m_events) {
+            QJsonObject args;
+            args["bytes"] = event.bytes;
+
+            // Complete ("X") events, timestamps in microseconds
+            QJsonObject object;
+            object["name"] = QString::fromLatin1(event.name);
+            object["cat"] = QString::fromLatin1(event.category);
+            object["ph"] = "X";
+            object["ts"] = event.startNs / 1000.0;
+            object["dur"] = event.durationNs / 1000.0;
+            object["pid"] = 1;
+            object["tid"] = qint64(event.threadId);
+            object["args"] = args;
+            events.append(object);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    file.close();
+
+    return true;
+}
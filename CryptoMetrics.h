@@ -0,0 +1,157 @@
+#ifndef CRYPTOMETRICS_H
+#define CRYPTOMETRICS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <memory>
+
+// 加解密热路径指标
+// Per-phase (KDF, key load, read, cipher, write) and per-operation timing and
+// byte counters, plus peak memory. Queryable as JSON; when tracing is enabled
+// every phase span is also kept and can be dumped as a Chrome trace_event file
+// (chrome://tracing, Perfetto).
+class CryptoMetrics
+{
+public:
+    enum Phase {
+        Kdf,
+        KeyLoad,
+        Read,
+        Cipher,
+        Write,
+        PhaseCount
+    };
+
+    static CryptoMetrics &instance();
+
+    // Times one phase from construction to destruction
+    class PhaseTimer
+    {
+    public:
+        explicit PhaseTimer(Phase phase, qint64 bytes = 0);
+        ~PhaseTimer();
+        void addBytes(qint64 bytes) { m_bytes += bytes; }
+
+    private:
+        Phase m_phase;
+        qint64 m_bytes;
+        qint64 m_start;
+    };
+
+    // Times a whole API call (encryptFileAES, ...); call setSucceeded before returning
+    class OperationTimer
+    {
+    public:
+        explicit OperationTimer(const char *operation);
+        ~OperationTimer();
+        void addBytes(qint64 bytes) { m_bytes += bytes; }
+        void setSucceeded(bool succeeded) { m_succeeded = succeeded; }
+
+    private:
+        const char *m_operation;
+        qint64 m_bytes;
+        qint64 m_start;
+        bool m_succeeded;
+    };
+
+    // Record an already measured span; startNs is on the now() clock
+    void recordPhase(Phase phase, qint64 startNs, qint64 durationNs, qint64 bytes);
+    void recordOperation(const char *operation, qint64 startNs, qint64 durationNs, qint64 bytes, bool succeeded);
+
+    // Monotonic nanoseconds since the metrics were created
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+
+    QJsonObject toJson() const;
+    void reset();
+
+    // Spans of one job, kept apart from the process-wide trace: the daemon runs
+    // commands of several clients, and each --trace gets only its own
+    class Trace
+    {
+    public:
+        bool write(const QString &path) const;
+        void clear();
+
+    private:
+        friend class CryptoMetrics;
+
+        struct Event
+        {
+            const char *name;
+            const char *category;
+            qint64 startNs;
+            qint64 durationNs;
+            qint64 bytes;
+            quint64 threadId;
+        };
+
+        void append(const Event &event);
+
+        mutable QMutex m_mutex;
+        QVector<Event> m_events;
+    };
+
+    // Also records the calling thread's spans into trace while it lives;
+    // JobScheduler::submit carries the current trace over to the tasks it
+    // queues (shared: a background task may outlive the command)
+    class TraceScope
+    {
+    public:
+        explicit TraceScope(const std::shared_ptr<Trace> &trace);
+        ~TraceScope();
+
+    private:
+        std::shared_ptr<Trace> m_previous;
+    };
+
+    static std::shared_ptr<Trace> currentTrace();
+
+    // Process-wide trace (GUI)
+    void setTraceEnabled(bool enabled);
+    bool isTraceEnabled() const { return m_traceEnabled.load(std::memory_order_relaxed); }
+    bool writeTrace(const QString &path) const;
+
+    static const char *phaseName(Phase phase);
+
+private:
+    CryptoMetrics();
+
+    void addTraceEvent(const char *name, const char *category, qint64 startNs, qint64 durationNs, qint64 bytes);
+    void updatePeakMemory();
+
+    struct Counter
+    {
+        std::atomic<qint64> count{0};
+        std::atomic<qint64> nanos{0};
+        std::atomic<qint64> bytes{0};
+    };
+
+    struct OperationStats
+    {
+        qint64 count = 0;
+        qint64 failures = 0;
+        qint64 nanos = 0;
+        qint64 maxNanos = 0;
+        qint64 bytes = 0;
+    };
+
+    // Upper bound on buffered events per trace (~40 MB)
+    static const int MaxTraceEvents = 1000000;
+
+    QElapsedTimer m_clock;
+    Counter m_phases[PhaseCount];
+    std::atomic<qint64> m_peakRssKb{0};
+
+    mutable QMutex m_mutex;
+    QHash<QString, OperationStats> m_operations;
+
+    std::atomic<bool> m_traceEnabled{false};
+    Trace m_trace;
+};
+
+#endif // CRYPTOMETRICS_H
@@ -0,0 +1,257 @@
+#include "CryptoService.h"
+#include "FileCatalog.h"
+#include "JobScheduler.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QQmlEngine>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <mutex>
+
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+CryptoService *CryptoService::instance()
+{
+    // Function-local static: constructed on first use, thread-safe
+    static CryptoService *service = new CryptoService();
+    return service;
+}
+
+QObject *CryptoService::qmlInstance(QQmlEngine *engine, QJSEngine *scriptEngine)
+{
+    Q_UNUSED(engine)
+    Q_UNUSED(scriptEngine)
+
+    CryptoService *service = instance();
+    QQmlEngine::setObjectOwnership(service, QQmlEngine::CppOwnership);
+    return service;
+}
+
+CryptoService::CryptoService()
+    : QObject(nullptr),
+      m_keyListValid(false)
+{
+    // Initialize OpenSSL once per process
+    static std::once_flag openSslInit;
+    std::call_once(openSslInit, []() {
+        OpenSSL_add_all_algorithms();
+        ERR_load_crypto_strings();
+    });
+
+    // Create keys directory if it doesn't exist
+    m_keysFolder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/keys";
+    QDir().mkpath(m_keysFolder);
+}
+
+QString CryptoService::keysFolderPath() const
+{
+    return m_keysFolder;
+}
+
+QThreadPool *CryptoService::workerPool()
+{
+    return JobScheduler::instance().pool(JobScheduler::Cpu);
+}
+
+QJsonObject CryptoService::keyFile(const QString &fileName)
+{
+    QFileInfo info(m_keysFolder + "/" + fileName);
+    if (!info.isFile()) {
+        return QJsonObject();
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_keyCache.constFind(fileName);
+        if (it != m_keyCache.constEnd()
+            && it->size == info.size() && it->modified == info.lastModified()) {
+            return it->data;
+        }
+    }
+
+    QFile file(info.filePath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QJsonObject();
+    }
+
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    file.close();
+    if (doc.isNull() || !doc.isObject()) {
+        return QJsonObject();
+    }
+
+    CachedKey cached;
+    cached.data = doc.object();
+    cached.modified = info.lastModified();
+    cached.size = info.size();
+
+    QMutexLocker locker(&m_mutex);
+    m_keyCache.insert(fileName, cached);
+    return cached.data;
+}
+
+bool CryptoService::writeKeyFile(const QString &fileName, const QJsonObject &data)
+{
+    QSaveFile file(m_keysFolder + "/" + fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    file.write(QJsonDocument(data).toJson());
+    if (!file.commit()) {
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_keyCache.remove(fileName);
+        m_keyListValid = false;
+    }
+
+    emit keysChanged();
+    return true;
+}
+
+bool CryptoService::removeKeyFile(const QString &fileName)
+{
+    if (!QFile::remove(m_keysFolder + "/" + fileName)) {
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_keyCache.remove(fileName);
+        m_keyListValid = false;
+    }
+
+    emit keysChanged();
+    return true;
+}
+
+QStringList CryptoService::keyList()
+{
+    // The folder's mtime changes whenever an entry is added or removed, so one
+    // stat catches keys copied in by hand as well
+    QDateTime folderModified = QFileInfo(m_keysFolder).lastModified();
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_keyListValid || folderModified != m_keyListModified) {
+        QDir keysDir(m_keysFolder);
+        QStringList filters;
+        filters << "*.key" << "*.aeskey";
+        m_keyList = keysDir.entryList(filters, QDir::Files, QDir::Name);
+        m_keyListModified = folderModified;
+        m_keyListValid = true;
+    }
+    return m_keyList;
+}
+
+void CryptoService::refreshKeys()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_keyCache.clear();
+        m_keyListValid = false;
+    }
+
+    emit keysChanged();
+}
+
+namespace {
+
+// Cached keys never share their buffer with a caller's copy: QByteArray is
+// implicitly shared, and OPENSSL_cleanse on a shared array detaches first and
+// wipes only the fresh copy, leaving the shared bytes behind
+QByteArray deepCopy(const QByteArray &bytes)
+{
+    return QByteArray(bytes.constData(), bytes.size());
+}
+
+} // namespace
+
+bool CryptoService::findMasterKey(const QByteArray &id, MasterKey &masterKey)
+{
+    if (id.isEmpty()) {
+        return false;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&m_masterKeyMutex);
+    expireMasterKeys(now);
+
+    auto it = m_masterKeys.find(id);
+    if (it == m_masterKeys.end()) {
+        return false;
+    }
+
+    it->lastUsed = now;
+    masterKey = it->masterKey;
+    masterKey.key = deepCopy(it->masterKey.key);
+    return true;
+}
+
+void CryptoService::storeMasterKey(const QByteArray &id, const MasterKey &masterKey)
+{
+    if (id.isEmpty()) {
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker locker(&m_masterKeyMutex);
+    expireMasterKeys(now);
+
+    CachedMasterKey &cached = m_masterKeys[id];
+    if (!cached.masterKey.key.isEmpty()) {
+        OPENSSL_cleanse(cached.masterKey.key.data(), cached.masterKey.key.size());
+    }
+    cached.masterKey = masterKey;
+    cached.masterKey.key = deepCopy(masterKey.key);
+    cached.lastUsed = now;
+}
+
+void CryptoService::clearMasterKeys()
+{
+    QMutexLocker locker(&m_masterKeyMutex);
+    expireMasterKeys(-1);
+}
+
+// now < 0 wipes everything; caller holds m_masterKeyMutex
+void CryptoService::expireMasterKeys(qint64 now)
+{
+    for (auto it = m_masterKeys.begin(); it != m_masterKeys.end();) {
+        if (now < 0 || now - it->lastUsed > MasterKeyLifetimeMs) {
+            OPENSSL_cleanse(it->masterKey.key.data(), it->masterKey.key.size());
+            it = m_masterKeys.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+QVariantList CryptoService::catalogFilesForKey(const QString &keyName, int limit)
+{
+    return FileCatalog::instance().filesForKey(keyName, limit);
+}
+
+QVariantList CryptoService::catalogFindByOutput(const QString &outputPath)
+{
+    return FileCatalog::instance().findByOutput(outputPath);
+}
+
+QVariantList CryptoService::catalogFindByHash(const QString &hexHash, int limit)
+{
+    return FileCatalog::instance().findByHash(hexHash, limit);
+}
+
+QVariantList CryptoService::catalogFindByPathPrefix(const QString &prefix, int limit)
+{
+    return FileCatalog::instance().findByPathPrefix(prefix, limit);
+}
+
+qint64 CryptoService::catalogCount()
+{
+    return FileCatalog::instance().count();
+}
@@ -0,0 +1,104 @@
+#ifndef CRYPTOSERVICE_H
+#define CRYPTOSERVICE_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVariantList>
+#include "KdfParams.h"
+
+class QQmlEngine;
+class QJSEngine;
+
+// 进程级加密服务
+// One instance per process, created on first use (first crypto call or first
+// access from QML as the CryptoService singleton). It owns what every
+// CryptoManager used to set up on its own: OpenSSL initialisation, the keys
+// folder, the crypto worker pool and a cache of parsed key files, so every
+// screen shares the same warm state. CryptoManager is a cheap facade on top.
+class CryptoService : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QStringList keyList READ keyList NOTIFY keysChanged)
+public:
+    static CryptoService *instance();
+
+    // Provider for qmlRegisterSingletonType; the instance stays C++ owned
+    static QObject *qmlInstance(QQmlEngine *engine, QJSEngine *scriptEngine);
+
+    QString keysFolderPath() const;
+
+    // Pool for CPU-bound crypto work (RSA, KDF, per-file batches); owned by JobScheduler
+    QThreadPool *workerPool();
+
+    // Parsed key file by file name ("name.key" / "name.aeskey"). Cached entries
+    // are reused until the file's size or modification time changes on disk.
+    QJsonObject keyFile(const QString &fileName);
+    bool writeKeyFile(const QString &fileName, const QJsonObject &data);
+    bool removeKeyFile(const QString &fileName);
+
+    // Key file names in the keys folder, sorted by name
+    QStringList keyList();
+
+    // Drop cached keys after changes made outside this process
+    Q_INVOKABLE void refreshKeys();
+
+    // Session cache of password-derived master keys for the batch file format:
+    // the KDF runs once per password and session instead of once per file.
+    // Entries are wiped after MasterKeyLifetimeMs without use.
+    struct MasterKey
+    {
+        QByteArray key;
+        QByteArray salt;
+        KdfParams kdf;
+    };
+    bool findMasterKey(const QByteArray &id, MasterKey &masterKey);
+    void storeMasterKey(const QByteArray &id, const MasterKey &masterKey);
+    Q_INVOKABLE void clearMasterKeys();
+
+    static const qint64 MasterKeyLifetimeMs = 10 * 60 * 1000;
+
+    // Catalog of encrypted files (see FileCatalog); rows are maps keyed by column name
+    Q_INVOKABLE QVariantList catalogFilesForKey(const QString &keyName, int limit = 1000);
+    Q_INVOKABLE QVariantList catalogFindByOutput(const QString &outputPath);
+    Q_INVOKABLE QVariantList catalogFindByHash(const QString &hexHash, int limit = 1000);
+    Q_INVOKABLE QVariantList catalogFindByPathPrefix(const QString &prefix, int limit = 1000);
+    Q_INVOKABLE qint64 catalogCount();
+
+signals:
+    void keysChanged();
+
+private:
+    CryptoService();
+
+    struct CachedKey
+    {
+        QJsonObject data;
+        QDateTime modified;
+        qint64 size = -1;
+    };
+
+    QString m_keysFolder;
+
+    QMutex m_mutex;
+    QHash<QString, CachedKey> m_keyCache;
+    QStringList m_keyList;
+    QDateTime m_keyListModified;
+    bool m_keyListValid;
+
+    struct CachedMasterKey
+    {
+        MasterKey masterKey;
+        qint64 lastUsed = 0;
+    };
+    void expireMasterKeys(qint64 now);
+
+    QMutex m_masterKeyMutex;
+    QHash<QByteArray, CachedMasterKey> m_masterKeys;
+};
+
+#endif // CRYPTOSERVICE_H
@@ -0,0 +1,85 @@
+#include "DecryptedImageProvider.h"
+#include "PreviewCache.h"
+#include "ThumbnailCache.h"
+#include <QBuffer>
+#include <QImageReader>
+#include <QUrl>
+
+QQuickImageResponse *DecryptedImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    // The id is the rest of the URL, still percent-encoded
+    return new DecryptedImageResponse(QUrl::fromPercentEncoding(id.toUtf8()), requestedSize,
+                                      DecryptedImageResponse::Preview, JobScheduler::Interactive);
+}
+
+bool DecryptedImageProvider::decode(QIODevice *device, const QSize &box, QImage &image, QString &error)
+{
+    QImageReader reader(device);
+    reader.setAutoTransform(true);
+
+    // Scaled decoding keeps the aspect ratio inside the requested box; a
+    // zero dimension leaves that side free. Never scales up.
+    QSize size = reader.size();
+    if (size.isValid() && (box.width() > 0 || box.height() > 0)) {
+        QSize bounds(box.width() > 0 ? box.width() : size.width(),
+                     box.height() > 0 ? box.height() : size.height());
+        QSize scaled = size.scaled(bounds, Qt::KeepAspectRatio);
+        if (scaled.width() < size.width()) {
+            reader.setScaledSize(scaled);
+        }
+    }
+
+    if (!reader.read(&image)) {
+        error = "Not an image: " + reader.errorString();
+        return false;
+    }
+    return true;
+}
+
+QQuickImageResponse *ThumbnailImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    return new DecryptedImageResponse(QUrl::fromPercentEncoding(id.toUtf8()), requestedSize,
+                                      DecryptedImageResponse::Thumbnail, JobScheduler::Normal);
+}
+
+DecryptedImageResponse::DecryptedImageResponse(const QString &path, const QSize &requestedSize, Source source,
+                                               JobScheduler::Priority priority)
+    : m_path(path),
+      m_requestedSize(requestedSize),
+      m_source(source)
+{
+    // The engine deletes the response after finished(); nothing touches it afterwards
+    JobScheduler::instance().submit([this]() { run(); }, priority);
+}
+
+QQuickTextureFactory *DecryptedImageResponse::textureFactory() const
+{
+    return QQuickTextureFactory::textureFactoryForImage(m_image);
+}
+
+void DecryptedImageResponse::run()
+{
+    if (m_cancelled.load()) {
+        emit finished();
+        return;
+    }
+
+    if (m_source == Thumbnail) {
+        m_image = ThumbnailCache::instance().thumbnail(m_path, m_error);
+        // Stored at ThumbnailCache::Size; smaller rows scale it down here
+        if (!m_image.isNull() && m_requestedSize.isValid() && !m_requestedSize.isEmpty()
+            && (m_image.width() > m_requestedSize.width() || m_image.height() > m_requestedSize.height())) {
+            m_image = m_image.scaled(m_requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+        emit finished();
+        return;
+    }
+
+    QByteArray data = PreviewCache::instance().plaintext(m_path, m_error);
+    if (!data.isEmpty()) {
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        DecryptedImageProvider::decode(&buffer, m_requestedSize, m_image, m_error);
+    }
+    emit finished();
+}
@@ -0,0 +1,63 @@
+#ifndef DECRYPTEDIMAGEPROVIDER_H
+#define DECRYPTEDIMAGEPROVIDER_H
+
+#include <QImage>
+#include <QQuickAsyncImageProvider>
+#include <atomic>
+#include "JobScheduler.h"
+
+class QIODevice;
+
+// 加密图片预览
+// "image://decrypted/<path>" shows an encrypted image without a plaintext
+// copy on disk: the file is decrypted into memory through PreviewCache and
+// decoded on a scheduler worker at Interactive priority. With sourceSize set,
+// JPEGs are decoded directly at the reduced size.
+class DecryptedImageProvider : public QQuickAsyncImageProvider
+{
+public:
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+    // Decode an image, scaled down to fit box (a zero side is unbounded)
+    static bool decode(QIODevice *device, const QSize &box, QImage &image, QString &error);
+};
+
+// 缩略图
+// "image://thumbnail/<path>" for file list rows: served from ThumbnailCache,
+// at Normal priority so an open preview still comes first. Rows scrolled out
+// of view cancel their request before it starts.
+class ThumbnailImageProvider : public QQuickAsyncImageProvider
+{
+public:
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+};
+
+class DecryptedImageResponse : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    enum Source {
+        Preview,
+        Thumbnail
+    };
+
+    DecryptedImageResponse(const QString &path, const QSize &requestedSize, Source source,
+                           JobScheduler::Priority priority);
+
+    QQuickTextureFactory *textureFactory() const override;
+    QString errorString() const override { return m_error; }
+    void cancel() override { m_cancelled.store(true); }
+
+private:
+    void run();
+
+    QString m_path;
+    QSize m_requestedSize;
+    Source m_source;
+    std::atomic<bool> m_cancelled{false};
+    QImage m_image;
+    QString m_error;
+};
+
+#endif // DECRYPTEDIMAGEPROVIDER_H
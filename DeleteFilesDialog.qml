@@ -0,0 +1,132 @@
+import QtQuick 2.15
+import QtQuick.Window 2.15
+import QtQuick.Controls 2.15
+import QtQuick.Layouts 1.15
+
+// 文件删除确认对话框（由EnDeCode按需通过Loader加载）
+Window {
+    id: deleteConfirmDialog
+    width: 400
+    height: 220 // 增加一点高度，显示更多信息
+    flags: Qt.Dialog | Qt.WindowCloseButtonHint
+    modality: Qt.ApplicationModal
+    visible: false
+    title: "确认删除"
+    x: transientParent ? transientParent.x + (transientParent.width - width) / 2 : 0
+    y: transientParent ? transientParent.y + (transientParent.height - height) / 2 : 0
+
+    property string fileName: ""
+    property int fileIndex: -1
+    property bool isBatchDelete: false
+    property var fileNames: []
+    property var fileIndices: []
+    property int fileCount: 0 // 添加一个属性来保存文件数量
+
+    // 用户确认删除，由EnDeCode从列表中移除文件
+    signal confirmed()
+
+    function open() {
+        // 更新文件计数
+        fileCount = fileIndices.length;
+        console.log("打开删除确认对话框: " + (isBatchDelete ? "批量删除 " + fileCount + " 个文件" : "单文件删除"));
+        visible = true;
+    }
+
+    function close() {
+        visible = false;
+    }
+
+    ColumnLayout {
+        anchors.fill: parent
+        anchors.margins: 20
+        spacing: 20
+
+        Text {
+            Layout.fillWidth: true
+            text: deleteConfirmDialog.isBatchDelete ? 
+                  "确定要删除选中的 " + deleteConfirmDialog.fileCount + " 个文件吗？\n此操作不可撤销。" :
+                  "确定要删除文件 \"" + deleteConfirmDialog.fileName + "\" 吗？\n此操作不可撤销。"
+            wrapMode: Text.WordWrap
+            font.pixelSize: 16
+            color: "#394149"
+        }
+
+        // 显示文件列表
+        Rectangle {
+            Layout.fillWidth: true
+            visible: deleteConfirmDialog.isBatchDelete && deleteConfirmDialog.fileCount > 0
+            height: deleteConfirmDialog.fileCount > 3 ? 60 : 30
+            color: "#F5F7FA"
+            
+            ScrollView {
+                anchors.fill: parent
+                clip: true
+                
+                Text {
+                    text: {
+                        if (!deleteConfirmDialog.isBatchDelete) return "";
+                        
+                        var files = [];
+                        for (var i = 0; i < Math.min(deleteConfirmDialog.fileCount, 5); i++) {
+                            if (i < deleteConfirmDialog.fileNames.length) {
+                                files.push(deleteConfirmDialog.fileNames[i]);
+                            }
+                        }
+                        
+                        if (deleteConfirmDialog.fileCount > 5) {
+                            files.push("以及其他 " + (deleteConfirmDialog.fileCount - 5) + " 个文件");
+                        }
+                        
+                        return files.join("\n");
+                    }
+                    font.pixelSize: 12
+                    color: "#666666"
+                    padding: 5
+                }
+            }
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            spacing: 10
+            Layout.alignment: Qt.AlignRight | Qt.AlignBottom
+
+            Button {
+                text: "取消"
+                implicitWidth: 100
+                implicitHeight: 40
+                font.pixelSize: 14
+
+                onClicked: {
+                    deleteConfirmDialog.close()
+                }
+            }
+
+            Button {
+                text: "删除"
+                implicitWidth: 100
+                implicitHeight: 40
+                font.pixelSize: 14
+
+                background: Rectangle {
+                    radius: 5
+                    color: "#E74C3C"
+                }
+
+                contentItem: Text {
+                    text: parent.text
+                    font: parent.font
+                    color: "white"
+                    horizontalAlignment: Text.AlignHCenter
+                    verticalAlignment: Text.AlignVCenter
+                }
+
+                onClicked: {
+                    console.log("删除确认: " + (deleteConfirmDialog.isBatchDelete ? "批量删除 " + deleteConfirmDialog.fileCount + " 个文件" : "单文件删除"))
+                    deleteConfirmDialog.confirmed()
+                    deleteConfirmDialog.close()
+                }
+            }
+        }
+    }
+}
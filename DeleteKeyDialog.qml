@@ -0,0 +1,83 @@
+import QtQuick 2.15
+import QtQuick.Window 2.15
+import QtQuick.Controls 2.15
+import QtQuick.Layouts 1.15
+
+// Delete confirmation dialog, loaded on demand by KeyManager
+Window {
+    id: deleteConfirmDialog
+    width: 400
+    height: 200
+    flags: Qt.Dialog | Qt.WindowCloseButtonHint
+    modality: Qt.ApplicationModal
+    visible: false
+    title: "确认删除"
+    x: transientParent ? transientParent.x + (transientParent.width - width) / 2 : 0
+    y: transientParent ? transientParent.y + (transientParent.height - height) / 2 : 0
+
+    property string keyName: ""
+
+    // 用户确认删除
+    signal confirmed(string keyName)
+
+    function open() {
+        visible = true;
+    }
+
+    function close() {
+        visible = false;
+    }
+
+    ColumnLayout {
+        anchors.fill: parent
+        anchors.margins: 20
+        spacing: 20
+
+        Text {
+            Layout.fillWidth: true
+            text: "确定要删除密钥 \"" + deleteConfirmDialog.keyName + "\" 吗？此操作不可撤销。"
+            wrapMode: Text.WordWrap
+            font.pixelSize: 16
+            color: "#394149"
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            spacing: 10
+
+            Button {
+                Layout.fillWidth: true
+                text: "取消"
+                font.pixelSize: 16
+
+                onClicked: {
+                    deleteConfirmDialog.close()
+                }
+            }
+
+            Button {
+                Layout.fillWidth: true
+                text: "删除"
+                font.pixelSize: 16
+
+                background: Rectangle {
+                    radius: 5
+                    color: "#E74C3C"
+                }
+
+                contentItem: Text {
+                    text: parent.text
+                    font: parent.font
+                    color: "white"
+                    horizontalAlignment: Text.AlignHCenter
+                    verticalAlignment: Text.AlignVCenter
+                }
+
+                onClicked: {
+                    deleteConfirmDialog.confirmed(deleteConfirmDialog.keyName)
+                    deleteConfirmDialog.close()
+                }
+            }
+        }
+    }
+}
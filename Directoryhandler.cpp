@@ -1,9 +1,15 @@
 #include "Directoryhandler.h"
+#include "CryptoDaemon.h"
+#include "FastFileCopy.h"
+#include "PreviewCache.h"
+#include "ThumbnailCache.h"
 #include <QDir>
 #include <QFileInfo>
 #include <QDateTime>
 #include <QDebug>
 
+#include <openssl/crypto.h>
+
 // Legacy XOR encryption functions (kept for backward compatibility)
 extern "C"
 {
@@ -126,6 +132,22 @@ DirectoryHandler::DirectoryHandler(QObject *parent)
             this, &DirectoryHandler::operationComplete);
     connect(cryptoManager, &CryptoManager::progressUpdate,
             this, &DirectoryHandler::progressUpdate);
+    connect(cryptoManager, &CryptoManager::fileVerified,
+            this, &DirectoryHandler::fileVerified);
+
+    // Bulk file operations report from worker threads; signals are queued to this thread
+    bulkOperation = new BulkFileOperation(this);
+    connect(bulkOperation, &BulkFileOperation::progressUpdate,
+            this, &DirectoryHandler::progressUpdate);
+    connect(bulkOperation, &BulkFileOperation::finished,
+            this, [this](bool success, int succeeded, int failed, const QString &message) {
+                emit bulkOperationFinished(success, succeeded, failed, message);
+                emit operationComplete(success, message);
+            });
+
+    // Text previews are decrypted on the scheduler; results are queued to this thread
+    connect(&PreviewCache::instance(), &PreviewCache::textReady,
+            this, &DirectoryHandler::previewTextReady);
 }
 
 void DirectoryHandler::listFiles(const QString &directoryPath, const QStringList &suffixes)
@@ -162,6 +184,16 @@ void DirectoryHandler::deCodeFile(const QString &filePath, const QString &output
     emit operationComplete(true, "File decrypted with legacy XOR decryption");
 }
 
+// Legacy XOR files straight to AES, without a plaintext copy on disk
+bool DirectoryHandler::migrateXorFiles(const QStringList &paths, const QString &xorKey, const QString &password)
+{
+    QStringList cleaned;
+    for (const QString &path : paths) {
+        cleaned.append(cleanFilePath(path));
+    }
+    return cryptoManager->migrateXorFiles(cleaned, xorKey, password);
+}
+
 // New AES encryption
 bool DirectoryHandler::encryptFileAES(const QString &inputFile, const QString &outputFile, const QString &password)
 {
@@ -198,6 +230,156 @@ bool DirectoryHandler::decryptFileHybrid(const QString &inputFile, const QString
     return cryptoManager->decryptFileHybrid(inputFile, outputFile, keyName, password);
 }
 
+// Hybrid encryption for several recipients, payload encrypted once
+bool DirectoryHandler::encryptFileHybridMulti(const QString &inputFile, const QString &outputFile, const QStringList &keyNames)
+{
+    return cryptoManager->encryptFileHybridMulti(inputFile, outputFile, keyNames);
+}
+
+// Key rotation: rewrap the content key in the header only
+bool DirectoryHandler::rewrapFileHybrid(const QString &file, const QString &oldKeyName, const QString &password, const QString &newKeyName)
+{
+    return cryptoManager->rewrapFileHybrid(file, oldKeyName, password, newKeyName);
+}
+
+bool DirectoryHandler::rewrapDirectoryHybrid(const QString &directory, const QString &oldKeyName, const QString &password, const QString &newKeyName)
+{
+    return cryptoManager->rewrapDirectoryHybrid(directory, oldKeyName, password, newKeyName);
+}
+
+// Verify-only mode: nothing is written to disk
+bool DirectoryHandler::verifyFile(const QString &file, const QString &keyName, const QString &password)
+{
+    return cryptoManager->verifyFile(cleanFilePath(file), keyName, password);
+}
+
+bool DirectoryHandler::verifyFiles(const QStringList &paths, const QString &keyName, const QString &password)
+{
+    QStringList cleaned;
+    for (const QString &path : paths) {
+        cleaned.append(cleanFilePath(path));
+    }
+    return cryptoManager->verifyFiles(cleaned, keyName, password);
+}
+
+int DirectoryHandler::findPassword(const QString &file, const QStringList &candidates)
+{
+    return cryptoManager->findPassword(cleanFilePath(file), candidates);
+}
+
+QStringList DirectoryHandler::keysForFile(const QString &file)
+{
+    return cryptoManager->keysForFile(cleanFilePath(file));
+}
+
+// Checksum manifests (sha256sum format)
+bool DirectoryHandler::createManifest(const QStringList &paths, const QString &manifestPath)
+{
+    QStringList cleaned;
+    for (const QString &path : paths) {
+        cleaned.append(cleanFilePath(path));
+    }
+    return cryptoManager->createManifest(cleaned, cleanFilePath(manifestPath));
+}
+
+bool DirectoryHandler::verifyManifest(const QString &manifestPath)
+{
+    return cryptoManager->verifyManifest(cleanFilePath(manifestPath));
+}
+
+// Encrypted directory archives
+bool DirectoryHandler::createArchive(const QString &directory, const QString &archivePath, const QString &password)
+{
+    return cryptoManager->createArchive(cleanFilePath(directory), cleanFilePath(archivePath), password);
+}
+
+QVariantList DirectoryHandler::listArchive(const QString &archivePath, const QString &password)
+{
+    return cryptoManager->listArchive(cleanFilePath(archivePath), password);
+}
+
+bool DirectoryHandler::extractArchive(const QString &archivePath, const QString &outputDirectory, const QString &password,
+                                      const QString &member)
+{
+    return cryptoManager->extractArchive(cleanFilePath(archivePath), cleanFilePath(outputDirectory), password, member);
+}
+
+// Job control: also stops a running bulk file operation
+void DirectoryHandler::cancelOperation()
+{
+    cryptoManager->cancelOperation();
+    bulkOperation->cancel();
+}
+
+void DirectoryHandler::pauseOperation()
+{
+    cryptoManager->pauseOperation();
+}
+
+void DirectoryHandler::resumeOperation()
+{
+    cryptoManager->resumeOperation();
+}
+
+void DirectoryHandler::discardCheckpoint(const QString &outputFile)
+{
+    cryptoManager->discardCheckpoint(cleanFilePath(outputFile));
+}
+
+void DirectoryHandler::setPriority(int priority)
+{
+    cryptoManager->setPriority(priority);
+}
+
+void DirectoryHandler::setMemoryBudget(int megabytes)
+{
+    cryptoManager->setMemoryBudget(megabytes);
+}
+
+int DirectoryHandler::memoryBudget()
+{
+    return cryptoManager->memoryBudget();
+}
+
+void DirectoryHandler::setCacheMode(const QString &mode)
+{
+    cryptoManager->setCacheMode(mode);
+}
+
+bool DirectoryHandler::setPreviewKey(const QString &keyName, const QString &password)
+{
+    QString error;
+    if (!PreviewCache::instance().setCredentials(keyName, password, error)) {
+        emit operationComplete(false, error);
+        return false;
+    }
+
+    // Thumbnails use the same credentials; previews still work without them
+    CryptoManager::DecryptionKeys keys = PreviewCache::instance().credentials();
+    bool thumbnails = ThumbnailCache::instance().setCredentials(keys, error);
+    OPENSSL_cleanse(keys.privateKey.data(), keys.privateKey.size());
+    if (!thumbnails) {
+        emit operationComplete(false, error);
+    }
+    return true;
+}
+
+void DirectoryHandler::clearPreview()
+{
+    PreviewCache::instance().clearCredentials();
+    ThumbnailCache::instance().clearCredentials();
+}
+
+void DirectoryHandler::requestPreviewText(const QString &filePath)
+{
+    PreviewCache::instance().requestText(cleanFilePath(filePath));
+}
+
+bool DirectoryHandler::isImageFile(const QString &fileName)
+{
+    return ThumbnailCache::isImageFile(fileName);
+}
+
 // Key Management functions
 bool DirectoryHandler::generateRSAKeyPair(const QString &name, const QString &password)
 {
@@ -230,6 +412,67 @@ bool DirectoryHandler::importKey(const QString &importPath, const QString &passw
     return cryptoManager->importKey(importPath, password);
 }
 
+int DirectoryHandler::calibrateKdf(int targetMilliseconds, const QString &algorithm)
+{
+    return cryptoManager->calibrateKdf(targetMilliseconds, algorithm);
+}
+
+QString DirectoryHandler::kdfSettings()
+{
+    return cryptoManager->kdfSettings();
+}
+
+bool DirectoryHandler::calibrateStorage(const QString &directory)
+{
+    return cryptoManager->calibrateStorage(directory);
+}
+
+QString DirectoryHandler::storageSettings(const QString &path)
+{
+    return cryptoManager->storageSettings(path);
+}
+
+void DirectoryHandler::setStorageAutoCalibrate(bool enabled)
+{
+    cryptoManager->setStorageAutoCalibrate(enabled);
+}
+
+QString DirectoryHandler::metricsJson()
+{
+    return cryptoManager->metricsJson();
+}
+
+void DirectoryHandler::resetMetrics()
+{
+    cryptoManager->resetMetrics();
+}
+
+void DirectoryHandler::setTraceEnabled(bool enabled)
+{
+    cryptoManager->setTraceEnabled(enabled);
+}
+
+bool DirectoryHandler::dumpTrace(const QString &path)
+{
+    return cryptoManager->dumpTrace(path);
+}
+
+void DirectoryHandler::submitDaemonCommand(const QStringList &arguments)
+{
+    // Driven by the event loop: no worker thread waits while the daemon works
+    CryptoDaemon::submit(arguments, this, [this](bool reached, int exitCode, const QString &output, const QString &errors) {
+        if (!reached) {
+            emit operationComplete(false, "The crypto daemon is not running");
+            return;
+        }
+
+        emit daemonCommandFinished(exitCode, output, errors);
+        // The daemon's last message line is the command's summary
+        QStringList lines = errors.split('\n', Qt::SkipEmptyParts);
+        emit operationComplete(exitCode == 0, lines.isEmpty() ? QString() : lines.last());
+    });
+}
+
 // 将此方法添加到 DirectoryHandler.cpp 文件中：
 
 bool DirectoryHandler::copyFile(const QString &sourceFile, const QString &destFile)
@@ -281,29 +524,10 @@ bool DirectoryHandler::copyFile(const QString &sourceFile, const QString &destFi
         }
     }
 
-    // 打开源文件用于读取
-    if (!source.open(QIODevice::ReadOnly)) {
-        emit operationComplete(false, "无法打开源文件: " + source.errorString());
-        return false;
-    }
-
-    // 打开目标文件用于写入
-    if (!dest.open(QIODevice::WriteOnly)) {
-        source.close();
-        emit operationComplete(false, "无法打开目标文件: " + dest.errorString());
-        return false;
-    }
-
-    // 复制文件内容
-    QByteArray data = source.readAll();
-    qint64 bytesWritten = dest.write(data);
-    
-    // 关闭文件
-    source.close();
-    dest.close();
-
-    if (bytesWritten != data.size()) {
-        emit operationComplete(false, "文件写入不完整: " + dest.errorString());
+    // 复制文件内容：优先reflink，其次内核态copy_file_range/sendfile，内存占用恒定
+    QString errorString;
+    if (!FastFileCopy::copyFile(cleanedSource, destFile, &errorString)) {
+        emit operationComplete(false, errorString);
         return false;
     }
 
@@ -363,27 +587,8 @@ bool DirectoryHandler::deleteFile(const QString &filePath)
 bool DirectoryHandler::clearTempFiles(const QString &directoryPath)
 {
     qDebug() << "正在清理目录中的所有临时文件:" << directoryPath;
-    
-    // 清理路径
-    QString cleanedPath = directoryPath;
-    
-#ifdef Q_OS_WIN
-    // Windows需要去掉最前面的斜杠
-    if (cleanedPath.startsWith("/")) {
-        cleanedPath = cleanedPath.mid(1);
-    }
-#else
-    // Linux平台处理
-    // 确保路径开头有斜杠
-    if (!cleanedPath.startsWith("/") && !cleanedPath.startsWith("./") && !cleanedPath.startsWith("../")) {
-        cleanedPath = "/" + cleanedPath;
-    }
-    
-    // 处理可能的双斜杠问题
-    while (cleanedPath.contains("//")) {
-        cleanedPath = cleanedPath.replace("//", "/");
-    }
-#endif
+
+    QString cleanedPath = cleanFilePath(directoryPath);
 
     QDir dir(cleanedPath);
     if (!dir.exists()) {
@@ -391,46 +596,100 @@ bool DirectoryHandler::clearTempFiles(const QString &directoryPath)
         emit operationComplete(false, "目录不存在: " + cleanedPath);
         return false;
     }
-    
+
     // 获取目录中的所有文件
     QStringList fileFilters;
-    fileFilters << "*.txt" << "*.jpg" << "*.png" << "*.pdf" << "*.doc" << "*.docx" 
+    fileFilters << "*.txt" << "*.jpg" << "*.png" << "*.pdf" << "*.doc" << "*.docx"
                 << "*.xls" << "*.xlsx" << "*.aes" << "*.rsa" << "*.enc" << "*.xor";
-                
-    QFileInfoList fileList = dir.entryInfoList(fileFilters, QDir::Files | QDir::NoDotAndDotDot);
-    
+
+    QStringList fileList = BulkFileOperation::expandPatterns(cleanedPath, fileFilters);
+
     // 没有找到匹配的文件
     if (fileList.isEmpty()) {
         qDebug() << "目录中没有找到需要清除的文件";
         emit operationComplete(true, "目录已清空 (没有匹配的文件)");
         return true;
     }
-    
-    int deleteCount = 0;
-    int errorCount = 0;
-    
-    // 逐个删除文件
-    foreach (QFileInfo fileInfo, fileList) {
-        QString filePath = fileInfo.absoluteFilePath();
-        qDebug() << "尝试删除文件:" << filePath;
-        
-        QFile file(filePath);
-        if (file.remove()) {
-            deleteCount++;
-            qDebug() << "成功删除文件:" << filePath;
-        } else {
-            errorCount++;
-            qDebug() << "删除文件失败:" << filePath << ":" << file.errorString();
-        }
+
+    // 删除在I/O线程池中并行进行；调用方依赖返回时文件已删除，因此在此等待完成。
+    // GUI线程在等待，所以以Interactive优先级运行，不会因加解密任务而挂起
+    if (!startBulkOperation(BulkFileOperation::Delete, fileList, QString(), JobScheduler::Interactive)) {
+        return false;
     }
-    
-    QString message = QString("已删除 %1 个文件").arg(deleteCount);
-    if (errorCount > 0) {
-        message += QString(", %1 个文件删除失败").arg(errorCount);
+    return bulkOperation->waitForFinished();
+}
+
+bool DirectoryHandler::deleteFiles(const QStringList &filePaths)
+{
+    return startBulkOperation(BulkFileOperation::Delete, filePaths, QString());
+}
+
+bool DirectoryHandler::copyFiles(const QStringList &sourceFiles, const QString &destDir)
+{
+    // cleanFilePath("") 会变成 "/"，空目标目录直接拒绝
+    if (destDir.trimmed().isEmpty()) {
+        emit operationComplete(false, "目标目录为空");
+        return false;
     }
-    
-    qDebug() << message;
-    emit operationComplete(errorCount == 0, message);
-    
-    return (errorCount == 0);
+    return startBulkOperation(BulkFileOperation::Copy, sourceFiles, cleanFilePath(destDir));
+}
+
+bool DirectoryHandler::moveFiles(const QStringList &sourceFiles, const QString &destDir)
+{
+    if (destDir.trimmed().isEmpty()) {
+        emit operationComplete(false, "目标目录为空");
+        return false;
+    }
+    return startBulkOperation(BulkFileOperation::Move, sourceFiles, cleanFilePath(destDir));
+}
+
+void DirectoryHandler::cancelBulkOperation()
+{
+    bulkOperation->cancel();
+}
+
+bool DirectoryHandler::startBulkOperation(BulkFileOperation::Operation operation, const QStringList &files, const QString &destDir,
+                                          JobScheduler::Priority priority)
+{
+    if (bulkOperation->isRunning()) {
+        emit operationComplete(false, "已有批量文件操作正在进行");
+        return false;
+    }
+
+    QStringList cleanedFiles;
+    for (const QString &file : files) {
+        cleanedFiles.append(cleanFilePath(file));
+    }
+
+    if (!bulkOperation->start(operation, cleanedFiles, destDir, priority)) {
+        emit operationComplete(false, "没有需要处理的文件");
+        return false;
+    }
+
+    return true;
+}
+
+QString DirectoryHandler::cleanFilePath(const QString &path)
+{
+    QString cleanedPath = path;
+
+#ifdef Q_OS_WIN
+    // Windows需要去掉最前面的斜杠
+    if (cleanedPath.startsWith("/")) {
+        cleanedPath = cleanedPath.mid(1);
+    }
+#else
+    // Linux平台处理
+    // 确保路径开头有斜杠
+    if (!cleanedPath.startsWith("/") && !cleanedPath.startsWith("./") && !cleanedPath.startsWith("../")) {
+        cleanedPath = "/" + cleanedPath;
+    }
+
+    // 处理可能的双斜杠问题
+    while (cleanedPath.contains("//")) {
+        cleanedPath = cleanedPath.replace("//", "/");
+    }
+#endif
+
+    return cleanedPath;
 }
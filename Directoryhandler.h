@@ -4,6 +4,7 @@
 #include <QObject>
 #include <QStringList>
 #include "CryptoManager.h"
+#include "BulkFileOperation.h"
 
 class DirectoryHandler : public QObject
 {
@@ -15,11 +16,23 @@ public:
     Q_INVOKABLE void listFiles(const QString &directoryPath, const QStringList &suffixes);
     Q_INVOKABLE bool copyFile(const QString &sourceFile, const QString &destFile);
     Q_INVOKABLE bool deleteFile(const QString &filePath);
+    // Deletes in parallel but returns only once the files are gone
     Q_INVOKABLE bool clearTempFiles(const QString &directoryPath);
 
+    // Bulk file operations over lists or globs, run on an I/O worker pool.
+    // Progress is reported through progressUpdate, the summary through
+    // bulkOperationFinished and operationComplete.
+    Q_INVOKABLE bool deleteFiles(const QStringList &filePaths);
+    Q_INVOKABLE bool copyFiles(const QStringList &sourceFiles, const QString &destDir);
+    Q_INVOKABLE bool moveFiles(const QStringList &sourceFiles, const QString &destDir);
+    Q_INVOKABLE void cancelBulkOperation();
+
     // Legacy Encryption/Decryption (backward compatibility)
     Q_INVOKABLE void enCodeFile(const QString &filePath, const QString &outputPath, const QString &key);
     Q_INVOKABLE void deCodeFile(const QString &filePath, const QString &outputPath, const QString &key);
+    // One-pass migration of .xor files to AES; originals are kept as .xor.bak
+    // because a wrong XOR key cannot be detected
+    Q_INVOKABLE bool migrateXorFiles(const QStringList &paths, const QString &xorKey, const QString &password);
 
     // New AES Encryption/Decryption
     Q_INVOKABLE bool encryptFileAES(const QString &inputFile, const QString &outputFile, const QString &password);
@@ -32,6 +45,46 @@ public:
     // Hybrid encryption (AES+RSA)
     Q_INVOKABLE bool encryptFileHybrid(const QString &inputFile, const QString &outputFile, const QString &keyName);
     Q_INVOKABLE bool decryptFileHybrid(const QString &inputFile, const QString &outputFile, const QString &keyName, const QString &password);
+    Q_INVOKABLE bool encryptFileHybridMulti(const QString &inputFile, const QString &outputFile, const QStringList &keyNames);
+    Q_INVOKABLE bool rewrapFileHybrid(const QString &file, const QString &oldKeyName, const QString &password, const QString &newKeyName);
+    Q_INVOKABLE bool rewrapDirectoryHybrid(const QString &directory, const QString &oldKeyName, const QString &password, const QString &newKeyName);
+
+    // Verify-only: decrypt without writing plaintext (empty keyName = AES password mode)
+    Q_INVOKABLE bool verifyFile(const QString &file, const QString &keyName, const QString &password);
+    Q_INVOKABLE bool verifyFiles(const QStringList &paths, const QString &keyName, const QString &password);
+    // Header-only key search: index of the matching password or -1; key pairs of a hybrid file
+    Q_INVOKABLE int findPassword(const QString &file, const QStringList &candidates);
+    Q_INVOKABLE QStringList keysForFile(const QString &file);
+    Q_INVOKABLE bool createManifest(const QStringList &paths, const QString &manifestPath);
+    Q_INVOKABLE bool verifyManifest(const QString &manifestPath);
+
+    // Encrypted directory archives
+    Q_INVOKABLE bool createArchive(const QString &directory, const QString &archivePath, const QString &password);
+    Q_INVOKABLE QVariantList listArchive(const QString &archivePath, const QString &password);
+    Q_INVOKABLE bool extractArchive(const QString &archivePath, const QString &outputDirectory, const QString &password,
+                                    const QString &member = QString());
+
+    // Cancel / pause / resume the running operation (thread-safe)
+    Q_INVOKABLE void cancelOperation();
+    Q_INVOKABLE void pauseOperation();
+    Q_INVOKABLE void resumeOperation();
+    Q_INVOKABLE void discardCheckpoint(const QString &outputFile);
+
+    // Scheduling class of crypto work started from here (-1 = automatic)
+    Q_INVOKABLE void setPriority(int priority);
+    Q_INVOKABLE void setMemoryBudget(int megabytes);
+    Q_INVOKABLE int memoryBudget();
+    Q_INVOKABLE void setCacheMode(const QString &mode);
+
+    // In-memory previews: image://decrypted/<path> in QML, text through
+    // previewTextReady. Keys are unlocked once here (empty keyName means
+    // password mode) and kept, with the decrypted cache, until clearPreview.
+    // The same key unlocks the encrypted thumbnails behind image://thumbnail/<path>.
+    Q_INVOKABLE bool setPreviewKey(const QString &keyName, const QString &password);
+    Q_INVOKABLE void clearPreview();
+    Q_INVOKABLE void requestPreviewText(const QString &filePath);
+    // Image suffix check behind thumbnails: pass the name without .aes/.enc/.rsa
+    Q_INVOKABLE bool isImageFile(const QString &fileName);
 
     // Key Management functions
     Q_INVOKABLE bool generateRSAKeyPair(const QString &name, const QString &password);
@@ -40,14 +93,39 @@ public:
     Q_INVOKABLE bool deleteKey(const QString &keyName);
     Q_INVOKABLE bool exportKey(const QString &keyName, const QString &exportPath, const QString &password);
     Q_INVOKABLE bool importKey(const QString &importPath, const QString &password);
+    Q_INVOKABLE int calibrateKdf(int targetMilliseconds, const QString &algorithm = "pbkdf2-sha256");
+    Q_INVOKABLE QString kdfSettings();
+    Q_INVOKABLE bool calibrateStorage(const QString &directory);
+    Q_INVOKABLE QString storageSettings(const QString &path);
+    Q_INVOKABLE void setStorageAutoCalibrate(bool enabled);
+
+    // Crypto metrics (JSON) and Chrome trace export
+    Q_INVOKABLE QString metricsJson();
+    Q_INVOKABLE void resetMetrics();
+    Q_INVOKABLE void setTraceEnabled(bool enabled);
+    Q_INVOKABLE bool dumpTrace(const QString &path);
+
+    // Run a CLI command line ("encrypt-aes", paths, "--password", ...) in the
+    // background daemon (safe daemon) with its warm caches. Results arrive through
+    // daemonCommandFinished and operationComplete; fails if no daemon is running.
+    Q_INVOKABLE void submitDaemonCommand(const QStringList &arguments);
 
 signals:
     void fileNameSignal(const QString &name, const int &time);
     void operationComplete(bool success, const QString &message);
     void progressUpdate(int percentage);
+    void fileVerified(const QString &file, bool ok, const QString &message);
+    void bulkOperationFinished(bool success, int succeeded, int failed, const QString &message);
+    void previewTextReady(const QString &file, const QString &text, const QString &error);
+    void daemonCommandFinished(int exitCode, const QString &output, const QString &errors);
 
 private:
+    static QString cleanFilePath(const QString &path);
+    bool startBulkOperation(BulkFileOperation::Operation operation, const QStringList &files, const QString &destDir,
+                            JobScheduler::Priority priority = JobScheduler::Background);
+
     CryptoManager *cryptoManager;
+    BulkFileOperation *bulkOperation;
 };
 
 #endif // DIRECTORYHANDLER_H
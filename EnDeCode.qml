@@ -68,21 +68,17 @@ Item {
                     directoryHandler.deleteAllFiles(root.filePath)
                     return true
                 } else {
-                    // 通过手动删除每个文件来实现清理
-                    console.log("DirectoryHandler不支持批量清除方法，尝试使用deleteFile逐个删除")
+                    // 通过批量删除接口清理列表中的文件
+                    console.log("DirectoryHandler不支持清除目录方法，使用deleteFiles批量删除")
                     
                     // 先获取所有文件
                     var files = []
                     for (var i = 0; i < fileModel.count; i++) {
-                        files.push(fileModel.get(i).name)
+                        files.push(root.filePath + fileModel.get(i).name)
                     }
                     
-                    // 然后逐个删除
-                    for (var j = 0; j < files.length; j++) {
-                        var filePath = root.filePath + files[j]
-                        console.log("删除文件: " + filePath)
-                        directoryHandler.deleteFile(filePath)
-                    }
+                    // 一次提交，由后台线程池删除
+                    directoryHandler.deleteFiles(files)
                     
                     return true
                 }
@@ -348,6 +344,15 @@ Item {
         }
     }
 
+    // 在密钥管理界面生成/导入/删除密钥后刷新密钥下拉框
+    Connections {
+        target: CryptoService
+
+        function onKeysChanged() {
+            keySelector.refreshKeyList()
+        }
+    }
+
     // 目录处理器连接
     Connections {
         target: directoryHandler
@@ -482,83 +487,46 @@ Item {
         }
     }
 
-    // 保留原来的对话框作为备用
-    Window {
-        id: fileInputDialog
-        title: "输入文件路径"
-        width: 500
-        height: 200
-        flags: Qt.Dialog | Qt.WindowCloseButtonHint
-        modality: Qt.ApplicationModal
-        visible: false
-
-        function open() {
-            visible = true;
-        }
-
-        function close() {
-            visible = false;
-        }
+    // 保留原来的对话框作为备用，仅在使用时加载
+    Loader {
+        id: fileInputLoader
+        active: false
+        source: "FilePathDialog.qml"
+    }
 
-        function accept() {
-            if (filePathInput.text.length > 0) {
-                var fileName = filePathInput.text;
-                var lastSlash = Math.max(fileName.lastIndexOf('/'), fileName.lastIndexOf('\\'));
-                var onlyFileName = fileName.substring(lastSlash + 1);
-                var sourceDir = fileName.substring(0, lastSlash + 1);
+    Connections {
+        target: fileInputLoader.item
 
-                // 直接添加到模型中
-                fileModel.append({
-                    "name": onlyFileName, 
-                    "time": new Date().getTime() / 1000, 
-                    "sourceDir": sourceDir,
-                    "fullPath": fileName
-                });
-                
-                selectIndex = fileModel.count - 1;
-                selectName = onlyFileName;
-                
-                showStatus("已导入文件: " + onlyFileName);
-            }
-            filePathInput.text = "";
-            close();
+        function onPathAccepted(path) {
+            importFilePath(path)
         }
+    }
 
-        ColumnLayout {
-            anchors.fill: parent
-            anchors.margins: 20
-            spacing: 20
-
-            Text {
-                text: "请输入文件的完整路径:"
-                font.pixelSize: 14
-            }
+    function openFileInputDialog() {
+        fileInputLoader.active = true
+        fileInputLoader.item.open()
+    }
 
-            TextField {
-                id: filePathInput
-                Layout.fillWidth: true
-                placeholderText: "例如: /home/user/documents/file.txt"
-                selectByMouse: true
-            }
+    // 直接按路径把文件添加到模型中
+    function importFilePath(fileName) {
+        var lastSlash = Math.max(fileName.lastIndexOf('/'), fileName.lastIndexOf('\\'));
+        var onlyFileName = fileName.substring(lastSlash + 1);
+        var sourceDir = fileName.substring(0, lastSlash + 1);
 
-            RowLayout {
-                Layout.fillWidth: true
-                spacing: 10
-                Layout.alignment: Qt.AlignRight
+        fileModel.append({
+            "name": onlyFileName,
+            "time": new Date().getTime() / 1000,
+            "sourceDir": sourceDir,
+            "fullPath": fileName
+        });
 
-                Button {
-                    text: "取消"
-                    onClicked: fileInputDialog.close()
-                }
+        selectIndex = fileModel.count - 1;
+        selectName = onlyFileName;
 
-                Button {
-                    text: "确定"
-                    onClicked: fileInputDialog.accept()
-                }
-            }
-        }
+        showStatus("已导入文件: " + onlyFileName);
     }
 
+
     // 背景
     Rectangle {
         anchors.fill: parent
@@ -2113,10 +2081,11 @@ Item {
                                                 anchors.fill: parent
                                                 onClicked: {
                                                     // 确认删除
-                                                    deleteConfirmDialog.fileName = model.name
-                                                    deleteConfirmDialog.fileIndex = index
-                                                    deleteConfirmDialog.isBatchDelete = false
-                                                    deleteConfirmDialog.open()
+                                                    var dialog = deleteConfirmDialog()
+                                                    dialog.fileName = model.name
+                                                    dialog.fileIndex = index
+                                                    dialog.isBatchDelete = false
+                                                    dialog.open()
                                                 }
                                             }
                                         }
@@ -2138,14 +2107,31 @@ Item {
                                                     radius: 8
                                                     color: getFileColor(model.name)
                                                     anchors.centerIn: parent
+                                                    clip: true
 
                                                     Text {
                                                         anchors.centerIn: parent
+                                                        visible: thumbnail.status !== Image.Ready
                                                         text: getFileExtension(model.name).toUpperCase()
                                                         font.pixelSize: 16
                                                         font.bold: true
                                                         color: "white"
                                                     }
+
+                                                    // 加密图片缩略图（需先设置预览密钥）
+                                                    Image {
+                                                        id: thumbnail
+                                                        anchors.fill: parent
+                                                        asynchronous: true
+                                                        cache: true
+                                                        fillMode: Image.PreserveAspectCrop
+                                                        sourceSize.width: 128
+                                                        sourceSize.height: 128
+                                                        visible: status === Image.Ready
+                                                        source: hasThumbnail(model.name)
+                                                                ? "image://thumbnail/" + encodeURIComponent(model.fullPath || ((model.sourceDir || root.filePath) + model.name))
+                                                                : ""
+                                                    }
                                                 }
                                             }
 
@@ -2221,6 +2207,12 @@ Item {
         }
     }
 
+    // 辅助函数：是否请求缩略图（去掉加密后缀后按图片扩展名判断）
+    function hasThumbnail(filename) {
+        var match = /^(.+)\.(aes|enc|rsa)$/i.exec(filename)
+        return match !== null && directoryHandler.isImageFile(match[1])
+    }
+
     // 辅助函数：获取文件扩展名
     function getFileExtension(filename) {
         if (filename.lastIndexOf(".") === -1) return "";
@@ -2613,8 +2605,9 @@ Item {
         console.log("准备批量删除，当前选中: " + selectedCount + " 个文件", "选中ID:", JSON.stringify(selectedFiles));
         
         // 确认批量删除
-        deleteConfirmDialog.fileNames = [];
-        deleteConfirmDialog.fileIndices = [];
+        var dialog = deleteConfirmDialog();
+        dialog.fileNames = [];
+        dialog.fileIndices = [];
         
         // 如果没有选中文件，直接返回
         if (selectedCount === 0) {
@@ -2632,8 +2625,8 @@ Item {
             if (idx >= 0 && idx < fileModel.count) {
                 try {
                     var fileName = fileModel.get(idx).name;
-                    deleteConfirmDialog.fileNames.push(fileName);
-                    deleteConfirmDialog.fileIndices.push(idx);
+                    dialog.fileNames.push(fileName);
+                    dialog.fileIndices.push(idx);
                     console.log("添加到删除列表: 索引=" + idx + ", 文件名=" + fileName);
                 } catch (e) {
                     console.error("获取文件信息出错: " + e);
@@ -2642,194 +2635,92 @@ Item {
         }
         
         // 再次确认文件数量正确
-        var fileCount = deleteConfirmDialog.fileIndices.length;
-        deleteConfirmDialog.fileCount = fileCount;
-        console.log("确认对话框: 选中文件数=" + fileCount + ", 数组长度=" + deleteConfirmDialog.fileIndices.length);
+        var fileCount = dialog.fileIndices.length;
+        dialog.fileCount = fileCount;
+        console.log("确认对话框: 选中文件数=" + fileCount + ", 数组长度=" + dialog.fileIndices.length);
         
         if (fileCount > 0) {
             // 显示提示信息
             showStatus("正在打开删除确认对话框，选中了 " + fileCount + " 个文件");
             
             // 设置批量删除标志
-            deleteConfirmDialog.isBatchDelete = true;
+            dialog.isBatchDelete = true;
             
             // 打开确认对话框
-            deleteConfirmDialog.open();
+            dialog.open();
         } else {
             console.log("没有有效文件可删除");
             showStatus("没有有效的文件可删除");
         }
     }
 
-    // 文件删除确认对话框
-    Window {
-        id: deleteConfirmDialog
-        width: 400
-        height: 220 // 增加一点高度，显示更多信息
-        flags: Qt.Dialog | Qt.WindowCloseButtonHint
-        modality: Qt.ApplicationModal
-        visible: false
-        title: "确认删除"
-        x: root && root.width ? (root.width - width) / 2 : 0
-        y: root && root.height ? (root.height - height) / 2 : 0
-
-        property string fileName: ""
-        property int fileIndex: -1
-        property bool isBatchDelete: false
-        property var fileNames: []
-        property var fileIndices: []
-        property int fileCount: 0 // 添加一个属性来保存文件数量
-
-        function open() {
-            // 更新文件计数
-            fileCount = fileIndices.length;
-            console.log("打开删除确认对话框: " + (isBatchDelete ? "批量删除 " + fileCount + " 个文件" : "单文件删除"));
-            visible = true;
-        }
+    // 文件删除确认对话框，首次删除时才加载
+    Loader {
+        id: deleteConfirmLoader
+        active: false
+        source: "DeleteFilesDialog.qml"
+    }
 
-        function close() {
-            visible = false;
-        }
+    Connections {
+        target: deleteConfirmLoader.item
 
-        ColumnLayout {
-            anchors.fill: parent
-            anchors.margins: 20
-            spacing: 20
+        function onConfirmed() {
+            removeConfirmedFiles(deleteConfirmLoader.item)
+        }
+    }
 
-            Text {
-                Layout.fillWidth: true
-                text: deleteConfirmDialog.isBatchDelete ? 
-                      "确定要删除选中的 " + deleteConfirmDialog.fileCount + " 个文件吗？\n此操作不可撤销。" :
-                      "确定要删除文件 \"" + deleteConfirmDialog.fileName + "\" 吗？\n此操作不可撤销。"
-                wrapMode: Text.WordWrap
-                font.pixelSize: 16
-                color: "#394149"
-            }
+    // 返回删除确认对话框，必要时先加载
+    function deleteConfirmDialog() {
+        deleteConfirmLoader.active = true
+        return deleteConfirmLoader.item
+    }
 
-            // 显示文件列表
-            Rectangle {
-                Layout.fillWidth: true
-                visible: deleteConfirmDialog.isBatchDelete && deleteConfirmDialog.fileCount > 0
-                height: deleteConfirmDialog.fileCount > 3 ? 60 : 30
-                color: "#F5F7FA"
-                
-                ScrollView {
-                    anchors.fill: parent
-                    clip: true
-                    
-                    Text {
-                        text: {
-                            if (!deleteConfirmDialog.isBatchDelete) return "";
-                            
-                            var files = [];
-                            for (var i = 0; i < Math.min(deleteConfirmDialog.fileCount, 5); i++) {
-                                if (i < deleteConfirmDialog.fileNames.length) {
-                                    files.push(deleteConfirmDialog.fileNames[i]);
-                                }
-                            }
-                            
-                            if (deleteConfirmDialog.fileCount > 5) {
-                                files.push("以及其他 " + (deleteConfirmDialog.fileCount - 5) + " 个文件");
-                            }
-                            
-                            return files.join("\n");
-                        }
-                        font.pixelSize: 12
-                        color: "#666666"
-                        padding: 5
-                    }
+    // 从列表中移除确认删除的文件
+    function removeConfirmedFiles(dialog) {
+        if (dialog.isBatchDelete) {
+            // 批量删除
+            var count = dialog.fileIndices.length
+            console.log("开始批量删除 " + count + " 个文件条目")
+
+            // 记录删除的文件索引，从大到小排序以防止删除过程中索引变化
+            var deletedIndices = dialog.fileIndices.slice().sort(function(a, b) { return b - a });
+
+            // 从模型中删除（从大到小删除避免索引变化）
+            for (var j = 0; j < deletedIndices.length; j++) {
+                var index = deletedIndices[j];
+                if (index >= 0 && index < fileModel.count) {
+                    console.log("从列表中移除索引: " + index);
+                    fileModel.remove(index);
                 }
             }
 
-            RowLayout {
-                Layout.fillWidth: true
-                spacing: 10
-                Layout.alignment: Qt.AlignRight | Qt.AlignBottom
-
-                Button {
-                    text: "取消"
-                    implicitWidth: 100
-                    implicitHeight: 40
-                    font.pixelSize: 14
+            // 重置选择并退出批量模式
+            batchMode = false;
+            clearAllSelections();
 
-                    onClicked: {
-                        deleteConfirmDialog.close()
-                    }
+            // 显示状态消息
+            showStatus("已从列表中移除 " + count + " 个文件");
+            console.log("批量删除完成，已从列表中移除 " + count + " 个文件");
+        } else {
+            // 单个文件删除
+            if (dialog.fileIndex >= 0 && dialog.fileIndex < fileModel.count) {
+                // 从模型中删除
+                try {
+                    console.log("从列表中移除文件索引: " + dialog.fileIndex);
+                    fileModel.remove(dialog.fileIndex);
+                } catch (e) {
+                    console.error("从模型移除文件失败: " + e);
                 }
 
-                Button {
-                    text: "删除"
-                    implicitWidth: 100
-                    implicitHeight: 40
-                    font.pixelSize: 14
-
-                    background: Rectangle {
-                        radius: 5
-                        color: "#E74C3C"
-                    }
-
-                    contentItem: Text {
-                        text: parent.text
-                        font: parent.font
-                        color: "white"
-                        horizontalAlignment: Text.AlignHCenter
-                        verticalAlignment: Text.AlignVCenter
-                    }
-
-                    onClicked: {
-                        console.log("删除确认: " + (deleteConfirmDialog.isBatchDelete ? "批量删除 " + deleteConfirmDialog.fileCount + " 个文件" : "单文件删除"))
-                        
-                        if (deleteConfirmDialog.isBatchDelete) {
-                            // 批量删除
-                            var count = deleteConfirmDialog.fileIndices.length
-                            console.log("开始批量删除 " + count + " 个文件条目")
-                            
-                            // 记录删除的文件索引，从大到小排序以防止删除过程中索引变化
-                            var deletedIndices = deleteConfirmDialog.fileIndices.slice().sort(function(a, b) { return b - a });
-                            
-                            // 从模型中删除（从大到小删除避免索引变化）
-                            for (var j = 0; j < deletedIndices.length; j++) {
-                                var index = deletedIndices[j];
-                                if (index >= 0 && index < fileModel.count) {
-                                    console.log("从列表中移除索引: " + index);
-                                    fileModel.remove(index);
-                                }
-                            }
-                            
-                            // 重置选择并退出批量模式
-                            batchMode = false;
-                            clearAllSelections();
-                            
-                            // 显示状态消息
-                            showStatus("已从列表中移除 " + count + " 个文件");
-                            console.log("批量删除完成，已从列表中移除 " + count + " 个文件");
-                        } else {
-                            // 单个文件删除
-                            if (deleteConfirmDialog.fileIndex >= 0 && deleteConfirmDialog.fileIndex < fileModel.count) {
-                                // 从模型中删除
-                                try {
-                                    console.log("从列表中移除文件索引: " + deleteConfirmDialog.fileIndex);
-                                    fileModel.remove(deleteConfirmDialog.fileIndex);
-                                } catch (e) {
-                                    console.error("从模型移除文件失败: " + e);
-                                }
-                                
-                                // 如果删除的是当前选中的文件，重置选择
-                                if (deleteConfirmDialog.fileIndex === selectIndex) {
-                                    selectIndex = -1;
-                                    selectName = "";
-                                    console.log("已重置文件选择");
-                                } else if (deleteConfirmDialog.fileIndex < selectIndex) {
-                                    // 如果删除的文件在当前选中文件之前，调整选择索引
-                                    selectIndex--;
-                                    console.log("调整选择索引为: " + selectIndex);
-                                }
-                            }
-                        }
-                        
-                        // 关闭对话框
-                        deleteConfirmDialog.close();
-                    }
+                // 如果删除的是当前选中的文件，重置选择
+                if (dialog.fileIndex === selectIndex) {
+                    selectIndex = -1;
+                    selectName = "";
+                    console.log("已重置文件选择");
+                } else if (dialog.fileIndex < selectIndex) {
+                    // 如果删除的文件在当前选中文件之前，调整选择索引
+                    selectIndex--;
+                    console.log("调整选择索引为: " + selectIndex);
                 }
             }
         }
@@ -0,0 +1,592 @@
+#include "EncryptedArchive.h"
+#include "BufferPool.h"
+#include "CryptoMetrics.h"
+#include "JobScheduler.h"
+#include "MemoryBudget.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTemporaryFile>
+#include <QtEndian>
+#include <cstring>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+namespace {
+
+const char kArchiveMagic[4] = { 'S', 'F', 'A', 'R' };
+const quint8 kArchiveVersion = 1;
+const int kHeaderSize = 4 + 4 + 12 + 16 + 16;
+const int kTrailerSize = 8 + 8 + 32;
+
+// Upper bound for the index, so a corrupt trailer cannot trigger a huge allocation
+const quint64 kMaxIndexSize = 256 * 1024 * 1024;
+
+struct CipherContext
+{
+    CipherContext() : ctx(EVP_CIPHER_CTX_new()) {}
+    ~CipherContext() { EVP_CIPHER_CTX_free(ctx); }
+    EVP_CIPHER_CTX *ctx;
+};
+
+struct DigestContext
+{
+    DigestContext() : ctx(EVP_MD_CTX_new()) {}
+    ~DigestContext() { EVP_MD_CTX_free(ctx); }
+    EVP_MD_CTX *ctx;
+};
+
+QByteArray hmacSha256(const QByteArray &key, const QByteArray &data)
+{
+    unsigned char mac[32];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), key.constData(), key.size(),
+         reinterpret_cast<const unsigned char*>(data.constData()), size_t(data.size()), mac, &length);
+    return QByteArray(reinterpret_cast<const char*>(mac), int(length));
+}
+
+// One KDF run; the encryption and MAC keys are split from its output with HMAC
+bool deriveKeys(const QString &password, const KdfParams &kdf, const unsigned char *salt,
+                QByteArray &encryptionKey, QByteArray &macKey)
+{
+    CryptoMetrics::PhaseTimer timer(CryptoMetrics::Kdf);
+
+    QByteArray passwordData = password.toUtf8();
+    unsigned char master[32];
+    bool ok = kdf.derive(passwordData, salt, 16, master, sizeof(master));
+    OPENSSL_cleanse(passwordData.data(), passwordData.size());
+    if (!ok) {
+        return false;
+    }
+
+    QByteArray masterKey = QByteArray::fromRawData(reinterpret_cast<const char*>(master), sizeof(master));
+    encryptionKey = hmacSha256(masterKey, "SFAR encryption");
+    macKey = hmacSha256(masterKey, "SFAR authentication");
+    OPENSSL_cleanse(master, sizeof(master));
+    return true;
+}
+
+// Position a CTR context at a byte offset of the key stream
+bool seekCtr(EVP_CIPHER_CTX *ctx, const QByteArray &key, const unsigned char *iv, qint64 offset)
+{
+    // counter = iv + offset / 16, as a 128-bit big-endian addition
+    unsigned char counter[16];
+    memcpy(counter, iv, sizeof(counter));
+    quint64 blocks = quint64(offset) / 16;
+    unsigned int carry = 0;
+    for (int i = 15; i >= 0 && (blocks != 0 || carry != 0); --i) {
+        unsigned int sum = counter[i] + unsigned(blocks & 0xff) + carry;
+        counter[i] = uchar(sum);
+        carry = sum >> 8;
+        blocks >>= 8;
+    }
+
+    EVP_CIPHER_CTX_reset(ctx);
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), nullptr,
+                           reinterpret_cast<const unsigned char*>(key.constData()), counter) != 1) {
+        return false;
+    }
+
+    // Skip into the block
+    int skip = int(offset % 16);
+    if (skip > 0) {
+        unsigned char scratch[16] = {};
+        int length = 0;
+        return EVP_EncryptUpdate(ctx, scratch, &length, scratch, skip) == 1;
+    }
+    return true;
+}
+
+QByteArray encodeHeader(const KdfParams &kdf, const unsigned char *salt, const unsigned char *iv)
+{
+    uchar header[kHeaderSize];
+    memcpy(header, kArchiveMagic, sizeof(kArchiveMagic));
+    header[4] = kArchiveVersion;
+    header[5] = quint8(kdf.algorithm);
+    header[6] = 0;
+    header[7] = 0;
+    qToBigEndian<quint32>(kdf.cost, header + 8);
+    qToBigEndian<quint32>(kdf.blockSize, header + 12);
+    qToBigEndian<quint32>(kdf.parallelism, header + 16);
+    memcpy(header + 20, salt, 16);
+    memcpy(header + 36, iv, 16);
+    return QByteArray(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+bool decodeHeader(const QByteArray &data, KdfParams &kdf, unsigned char *salt, unsigned char *iv)
+{
+    if (data.size() != kHeaderSize || memcmp(data.constData(), kArchiveMagic, sizeof(kArchiveMagic)) != 0) {
+        return false;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar*>(data.constData());
+    if (header[4] != kArchiveVersion) {
+        return false;
+    }
+
+    kdf.algorithm = header[5];
+    kdf.cost = qFromBigEndian<quint32>(header + 8);
+    kdf.blockSize = qFromBigEndian<quint32>(header + 12);
+    kdf.parallelism = qFromBigEndian<quint32>(header + 16);
+    memcpy(salt, header + 20, 16);
+    memcpy(iv, header + 36, 16);
+    return kdf.isValid();
+}
+
+QByteArray encodeIndex(const QList<EncryptedArchive::Member> &members)
+{
+    QByteArray index;
+    QDataStream stream(&index, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << quint32(members.size());
+    for (const EncryptedArchive::Member &member : members) {
+        stream << member.path.toUtf8() << quint64(member.offset) << quint64(member.size)
+               << qint64(member.modified) << member.permissions << member.sha256;
+    }
+    return index;
+}
+
+// Relative, normalized and inside the extraction directory
+bool isSafeMemberPath(const QString &path)
+{
+    return !path.isEmpty() && QDir::cleanPath(path) == path && !QDir::isAbsolutePath(path)
+           && path != "." && path != ".." && !path.startsWith("../");
+}
+
+bool decodeIndex(const QByteArray &index, qint64 dataSize, QList<EncryptedArchive::Member> &members)
+{
+    QDataStream stream(index);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 count = 0;
+    stream >> count;
+    // Every entry needs at least 68 bytes; rejects absurd counts before reserving
+    if (stream.status() != QDataStream::Ok || quint64(count) * 68 > quint64(index.size())) {
+        return false;
+    }
+
+    members.clear();
+    members.reserve(int(count));
+    for (quint32 i = 0; i < count; ++i) {
+        QByteArray path;
+        quint64 offset = 0;
+        quint64 size = 0;
+        EncryptedArchive::Member member;
+        stream >> path >> offset >> size >> member.modified >> member.permissions >> member.sha256;
+        if (stream.status() != QDataStream::Ok || member.sha256.size() != 32
+            || offset > quint64(dataSize) || size > quint64(dataSize) - offset) {
+            return false;
+        }
+
+        member.path = QString::fromUtf8(path);
+        member.offset = qint64(offset);
+        member.size = qint64(size);
+        if (!isSafeMemberPath(member.path)) {
+            return false;
+        }
+        members.append(member);
+    }
+    return true;
+}
+
+} // namespace
+
+EncryptedArchive::~EncryptedArchive()
+{
+    OPENSSL_cleanse(m_encryptionKey.data(), m_encryptionKey.size());
+    OPENSSL_cleanse(m_macKey.data(), m_macKey.size());
+}
+
+bool EncryptedArchive::create(const QString &directory, const QString &archivePath, const QString &password,
+                              const KdfParams &kdf, QString &error, const ProgressCallback &progress,
+                              PageCacheAdvisor::Mode cacheMode)
+{
+    QDir root(directory);
+    if (!root.exists()) {
+        error = "Directory does not exist";
+        return false;
+    }
+
+    // Collect first so progress can be reported against the total size
+    QString archiveFile = QFileInfo(archivePath).absoluteFilePath();
+    QStringList files;
+    qint64 totalBytes = 0;
+    QDirIterator it(root.absolutePath(), QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString file = it.next();
+        if (it.fileInfo().absoluteFilePath() != archiveFile) {
+            files.append(file);
+            totalBytes += it.fileInfo().size();
+        }
+    }
+
+    unsigned char salt[16];
+    unsigned char iv[16];
+    if (RAND_bytes(salt, sizeof(salt)) != 1 || RAND_bytes(iv, sizeof(iv)) != 1) {
+        error = "Random number generation failed";
+        return false;
+    }
+
+    EncryptedArchive keys;
+    if (!deriveKeys(password, kdf, salt, keys.m_encryptionKey, keys.m_macKey)) {
+        error = "Key derivation failed";
+        return false;
+    }
+
+    CipherContext cipher;
+    DigestContext digest;
+    if (!cipher.ctx || !digest.ctx || !seekCtr(cipher.ctx, keys.m_encryptionKey, iv, 0)) {
+        error = "Cipher initialization failed";
+        return false;
+    }
+
+    QSaveFile out(archivePath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        error = "Failed to open output file";
+        return false;
+    }
+
+    QByteArray header = encodeHeader(kdf, salt, iv);
+    out.write(header);
+
+    if (cacheMode == PageCacheAdvisor::Direct) {
+        cacheMode = PageCacheAdvisor::DropBehind;
+    }
+    PageCacheAdvisor outCache(&out, PageCacheAdvisor::Output, cacheMode);
+
+    // Ciphertext is staged in one chunk so small members go out in large writes
+    MemoryBudget::Reservation memory(2 * qint64(BufferPool::blockSize(BufferPool::ChunkSize)));
+    PooledBuffer inBuffer = BufferPool::instance().acquire(BufferPool::ChunkSize);
+    PooledBuffer outBuffer = BufferPool::instance().acquire(BufferPool::ChunkSize);
+    if (inBuffer.isNull() || outBuffer.isNull()) {
+        error = "Out of memory";
+        return false;
+    }
+
+    CryptoMetrics &metrics = CryptoMetrics::instance();
+    int staged = 0;
+    auto flush = [&]() {
+        qint64 start = metrics.now();
+        bool ok = staged == 0 || out.write(outBuffer.constData(), staged) == staged;
+        metrics.recordPhase(CryptoMetrics::Write, start, metrics.now() - start, staged);
+        staged = 0;
+        outCache.advance();
+        return ok;
+    };
+
+    QList<Member> members;
+    members.reserve(files.size());
+    qint64 offset = 0;
+    int lastPercentage = -1;
+
+    for (const QString &path : files) {
+        QFile in(path);
+        if (!in.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            out.cancelWriting();
+            error = "Failed to open " + path;
+            return false;
+        }
+
+        QFileInfo info(path);
+        Member member;
+        member.path = root.relativeFilePath(path);
+        member.offset = offset;
+        member.modified = info.lastModified().toMSecsSinceEpoch();
+        member.permissions = quint32(info.permissions());
+
+        PageCacheAdvisor inCache(&in, PageCacheAdvisor::Input, cacheMode);
+
+        // Read exactly the size seen while scanning: no extra read() to find EOF
+        const qint64 expected = info.size();
+        if (EVP_DigestInit_ex(digest.ctx, EVP_sha256(), nullptr) != 1) {
+            out.cancelWriting();
+            error = "Digest initialization failed";
+            return false;
+        }
+        while (member.size < expected) {
+            JobScheduler::instance().yieldPoint();
+            qint64 start = metrics.now();
+            qint64 bytesRead = in.read(inBuffer.data(), qMin<qint64>(BufferPool::ChunkSize - staged, expected - member.size));
+            if (bytesRead < 0) {
+                out.cancelWriting();
+                error = "Failed to read " + path;
+                return false;
+            }
+            if (bytesRead == 0) {
+                break; // file shrank since the scan
+            }
+
+            qint64 readDone = metrics.now();
+            int length = 0;
+            if (EVP_DigestUpdate(digest.ctx, inBuffer.bytes(), size_t(bytesRead)) != 1
+                || EVP_EncryptUpdate(cipher.ctx, outBuffer.bytes() + staged, &length, inBuffer.bytes(),
+                                     int(bytesRead)) != 1) {
+                out.cancelWriting();
+                error = "Encryption failed";
+                return false;
+            }
+            metrics.recordPhase(CryptoMetrics::Read, start, readDone - start, bytesRead);
+            metrics.recordPhase(CryptoMetrics::Cipher, readDone, metrics.now() - readDone, bytesRead);
+
+            staged += length;
+            member.size += bytesRead;
+            inCache.advance();
+            if (staged == BufferPool::ChunkSize && !flush()) {
+                out.cancelWriting();
+                error = "Failed to write output file";
+                return false;
+            }
+        }
+
+        member.sha256.resize(32);
+        unsigned int digestLength = 0;
+        if (EVP_DigestFinal_ex(digest.ctx, reinterpret_cast<unsigned char*>(member.sha256.data()), &digestLength) != 1
+            || digestLength != 32) {
+            out.cancelWriting();
+            error = "Digest failed for " + path;
+            return false;
+        }
+        offset += member.size;
+        members.append(member);
+
+        if (progress && totalBytes > 0) {
+            int percentage = int(qMin(offset, totalBytes) * 100 / totalBytes);
+            if (percentage != lastPercentage) {
+                lastPercentage = percentage;
+                progress(percentage);
+            }
+        }
+    }
+
+    if (!flush()) {
+        out.cancelWriting();
+        error = "Failed to write output file";
+        return false;
+    }
+
+    // The index continues the key stream right after the data
+    QByteArray index = encodeIndex(members);
+    QByteArray indexCipher(index.size(), Qt::Uninitialized);
+    int indexLength = 0;
+    if (EVP_EncryptUpdate(cipher.ctx, reinterpret_cast<unsigned char*>(indexCipher.data()), &indexLength,
+                          reinterpret_cast<const unsigned char*>(index.constData()), index.size()) != 1) {
+        out.cancelWriting();
+        error = "Encryption failed";
+        return false;
+    }
+
+    uchar offsets[16];
+    qToBigEndian<quint64>(quint64(offset), offsets);
+    qToBigEndian<quint64>(quint64(indexCipher.size()), offsets + 8);
+    QByteArray trailer(reinterpret_cast<const char*>(offsets), sizeof(offsets));
+    trailer += hmacSha256(keys.m_macKey, header + indexCipher + trailer);
+
+    if (out.write(indexCipher) != indexCipher.size() || out.write(trailer) != trailer.size() || !out.commit()) {
+        error = "Failed to write output file";
+        return false;
+    }
+
+    if (progress) {
+        progress(100);
+    }
+    return true;
+}
+
+bool EncryptedArchive::open(const QString &archivePath, const QString &password, QString &error)
+{
+    m_members.clear();
+    m_file.close();
+    m_file.setFileName(archivePath);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        error = "Failed to open archive";
+        return false;
+    }
+
+    KdfParams kdf;
+    unsigned char salt[16];
+    QByteArray header = m_file.read(kHeaderSize);
+    const qint64 fileSize = m_file.size();
+    if (!decodeHeader(header, kdf, salt, m_iv) || fileSize < kHeaderSize + kTrailerSize) {
+        error = "Not an encrypted archive";
+        return false;
+    }
+
+    m_file.seek(fileSize - kTrailerSize);
+    QByteArray trailer = m_file.read(kTrailerSize);
+    const quint64 dataSize = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(trailer.constData()));
+    const quint64 indexSize = qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(trailer.constData()) + 8);
+    const quint64 payloadSize = quint64(fileSize - kHeaderSize - kTrailerSize);
+    if (trailer.size() != kTrailerSize || indexSize > kMaxIndexSize || indexSize > payloadSize
+        || dataSize != payloadSize - indexSize) {
+        error = "Corrupted archive";
+        return false;
+    }
+
+    if (!deriveKeys(password, kdf, salt, m_encryptionKey, m_macKey)) {
+        error = "Key derivation failed";
+        return false;
+    }
+
+    m_file.seek(kHeaderSize + qint64(dataSize));
+    QByteArray indexCipher = m_file.read(qint64(indexSize));
+    QByteArray mac = hmacSha256(m_macKey, header + indexCipher + trailer.left(16));
+    if (indexCipher.size() != int(indexSize) || CRYPTO_memcmp(mac.constData(), trailer.constData() + 16, 32) != 0) {
+        error = "Wrong password or corrupted archive";
+        return false;
+    }
+
+    CipherContext cipher;
+    if (!cipher.ctx || !seekCtr(cipher.ctx, m_encryptionKey, m_iv, qint64(dataSize))) {
+        error = "Cipher initialization failed";
+        return false;
+    }
+
+    QByteArray index(indexCipher.size(), Qt::Uninitialized);
+    int length = 0;
+    if (EVP_EncryptUpdate(cipher.ctx, reinterpret_cast<unsigned char*>(index.data()), &length,
+                          reinterpret_cast<const unsigned char*>(indexCipher.constData()), indexCipher.size()) != 1
+        || !decodeIndex(index, qint64(dataSize), m_members)) {
+        error = "Corrupted archive index";
+        return false;
+    }
+    return true;
+}
+
+int EncryptedArchive::indexOf(const QString &path) const
+{
+    QString cleaned = QDir::cleanPath(path);
+    for (int i = 0; i < m_members.size(); ++i) {
+        if (m_members[i].path == cleaned) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool EncryptedArchive::extract(const Member &member, const QString &outputFile, QString &error)
+{
+    CipherContext cipher;
+    DigestContext digest;
+    if (!cipher.ctx || !digest.ctx || !seekCtr(cipher.ctx, m_encryptionKey, m_iv, member.offset)
+        || EVP_DigestInit_ex(digest.ctx, EVP_sha256(), nullptr) != 1) {
+        error = "Cipher initialization failed";
+        return false;
+    }
+
+    if (!m_file.seek(kHeaderSize + member.offset)) {
+        error = "Corrupted archive";
+        return false;
+    }
+
+    // Unverified plaintext never sits at outputFile: it goes to a hidden
+    // temporary next to it, renamed into place only once the hash matched
+    // (removed otherwise, also if we return early). Not QSaveFile: an fsync
+    // per member would make extracting many small files sync-bound.
+    QFileInfo target(outputFile);
+    QTemporaryFile out(target.absoluteDir().filePath("." + target.fileName() + ".XXXXXX"));
+    if (!out.open()) {
+        error = "Failed to open " + outputFile;
+        return false;
+    }
+
+    MemoryBudget::Reservation memory(BufferPool::blockSize(BufferPool::ChunkSize));
+    PooledBuffer buffer = BufferPool::instance().acquire(BufferPool::ChunkSize);
+    if (buffer.isNull()) {
+        error = "Out of memory";
+        return false;
+    }
+
+    CryptoMetrics &metrics = CryptoMetrics::instance();
+    qint64 remaining = member.size;
+    bool ok = true;
+    while (ok && remaining > 0) {
+        JobScheduler::instance().yieldPoint();
+        qint64 start = metrics.now();
+        qint64 bytesRead = m_file.read(buffer.data(), qMin<qint64>(remaining, BufferPool::ChunkSize));
+        if (bytesRead <= 0) {
+            ok = false;
+            break;
+        }
+
+        qint64 readDone = metrics.now();
+        int length = 0;
+        if (EVP_EncryptUpdate(cipher.ctx, buffer.bytes(), &length, buffer.bytes(), int(bytesRead)) != 1
+            || EVP_DigestUpdate(digest.ctx, buffer.bytes(), size_t(length)) != 1) {
+            ok = false;
+            break;
+        }
+
+        qint64 cipherDone = metrics.now();
+        ok = out.write(buffer.constData(), length) == length;
+        metrics.recordPhase(CryptoMetrics::Read, start, readDone - start, bytesRead);
+        metrics.recordPhase(CryptoMetrics::Cipher, readDone, cipherDone - readDone, bytesRead);
+        metrics.recordPhase(CryptoMetrics::Write, cipherDone, metrics.now() - cipherDone, length);
+        remaining -= bytesRead;
+    }
+
+    unsigned char hash[32];
+    unsigned int hashLength = 0;
+    if (!ok || EVP_DigestFinal_ex(digest.ctx, hash, &hashLength) != 1 || hashLength != sizeof(hash)
+        || !out.flush()) {
+        error = "Failed to extract " + member.path;
+        return false;
+    }
+    if (CRYPTO_memcmp(hash, member.sha256.constData(), sizeof(hash)) != 0) {
+        error = member.path + ": content does not match the archive index";
+        return false;
+    }
+
+    out.setFileTime(QDateTime::fromMSecsSinceEpoch(member.modified), QFileDevice::FileModificationTime);
+    out.setPermissions(QFileDevice::Permissions(member.permissions));
+    if (!out.rename(outputFile)) {
+        error = "Failed to write " + outputFile;
+        return false;
+    }
+    out.setAutoRemove(false);
+    return true;
+}
+
+bool EncryptedArchive::extractAll(const QString &outputDirectory, QString &error, const ProgressCallback &progress)
+{
+    QDir root(outputDirectory);
+    qint64 totalBytes = 0;
+    for (const Member &member : m_members) {
+        totalBytes += member.size;
+    }
+
+    // Members are stored in order, so the archive is read front to back
+    QString lastDirectory;
+    qint64 done = 0;
+    int lastPercentage = -1;
+    for (const Member &member : m_members) {
+        QString target = root.filePath(member.path);
+        QString directory = QFileInfo(target).absolutePath();
+        if (directory != lastDirectory) {
+            if (!QDir().mkpath(directory)) {
+                error = "Failed to create " + directory;
+                return false;
+            }
+            lastDirectory = directory;
+        }
+
+        if (!extract(member, target, error)) {
+            return false;
+        }
+
+        done += member.size;
+        if (progress && totalBytes > 0) {
+            int percentage = int(done * 100 / totalBytes);
+            if (percentage != lastPercentage) {
+                lastPercentage = percentage;
+                progress(percentage);
+            }
+        }
+    }
+    return true;
+}
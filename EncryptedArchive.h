@@ -0,0 +1,73 @@
+#ifndef ENCRYPTEDARCHIVE_H
+#define ENCRYPTEDARCHIVE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <functional>
+#include "KdfParams.h"
+#include "PageCacheAdvisor.h"
+
+// 加密归档容器
+// Packs a directory tree into one encrypted file with a single key derivation,
+// so many small files cost one KDF, one output file and large sequential
+// writes instead of a KDF, an open/close and a padded output each.
+//
+// Layout ("SFAR", version 1):
+//   HEADER  magic(4) + version/kdf(4) + kdf cost, r, p (12) + salt(16) + iv(16)
+//   DATA    member contents, concatenated, AES-256-CTR
+//   INDEX   member table, AES-256-CTR continuing the same key stream
+//   TRAILER index offset(8) + index length(8) + HMAC-SHA256(header, index, offsets)
+// Encryption and MAC keys are derived from one KDF output. The HMAC covers
+// the header, the index and the offsets but NOT the DATA section: member
+// contents are only protected by the per-member SHA-256 in the (authenticated)
+// index, checked when a member is extracted. Listing therefore only reads the
+// header, index and trailer, and a single member can be decrypted by seeking
+// (CTR).
+class EncryptedArchive
+{
+public:
+    struct Member
+    {
+        QString path;        // relative, '/' separated
+        qint64 offset = 0;   // into DATA
+        qint64 size = 0;
+        qint64 modified = 0; // ms since epoch
+        quint32 permissions = 0;
+        QByteArray sha256;
+    };
+
+    typedef std::function<void(int percentage)> ProgressCallback;
+
+    EncryptedArchive() = default;
+    ~EncryptedArchive();
+
+    // Pack every regular file below directory (symlinks are skipped). Members
+    // are read in unaligned pieces, so Direct behaves like DropBehind here.
+    static bool create(const QString &directory, const QString &archivePath, const QString &password,
+                       const KdfParams &kdf, QString &error, const ProgressCallback &progress = ProgressCallback(),
+                       PageCacheAdvisor::Mode cacheMode = PageCacheAdvisor::Cached);
+
+    // Read and authenticate the index; a wrong password fails here
+    bool open(const QString &archivePath, const QString &password, QString &error);
+
+    const QList<Member> &members() const { return m_members; }
+    int indexOf(const QString &path) const;
+
+    // Decrypt one member to outputFile, checking it against the index hash
+    bool extract(const Member &member, const QString &outputFile, QString &error);
+    bool extractAll(const QString &outputDirectory, QString &error, const ProgressCallback &progress = ProgressCallback());
+
+private:
+    EncryptedArchive(const EncryptedArchive &) = delete;
+    EncryptedArchive &operator=(const EncryptedArchive &) = delete;
+
+    QFile m_file;
+    QByteArray m_encryptionKey;
+    QByteArray m_macKey;
+    unsigned char m_iv[16] = {};
+    QList<Member> m_members;
+};
+
+#endif // ENCRYPTEDARCHIVE_H
@@ -0,0 +1,195 @@
+#include "FastFileCopy.h"
+#include <QFile>
+#include <QtGlobal>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#ifdef Q_OS_UNIX
+namespace {
+
+// 每次系统调用复制的最大字节数
+const size_t kKernelCopyChunk = 64 * 1024 * 1024;
+
+bool copyBuffered(int inFd, int outFd)
+{
+    std::vector<char> buffer(FastFileCopy::BufferSize);
+
+    for (;;) {
+        ssize_t bytesRead = ::read(inFd, buffer.data(), buffer.size());
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytesRead == 0) {
+            return true;
+        }
+
+        const char *p = buffer.data();
+        while (bytesRead > 0) {
+            ssize_t bytesWritten = ::write(outFd, p, bytesRead);
+            if (bytesWritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            p += bytesWritten;
+            bytesRead -= bytesWritten;
+        }
+    }
+}
+
+#ifdef Q_OS_LINUX
+// Errors meaning "this mechanism is not available here", as opposed to real I/O errors
+bool isUnsupported(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL
+           || error == EOPNOTSUPP || error == ENOTSUP || error == EBADF;
+}
+#endif
+
+} // namespace
+#endif
+
+bool FastFileCopy::copyDescriptor(int inFd, int outFd, Method *usedMethod)
+{
+#ifdef Q_OS_UNIX
+#ifdef Q_OS_LINUX
+    // Reflink: the destination shares the source extents, no data is copied.
+    // FICLONE always clones the whole file, so only use it from offset 0 to 0.
+    if (::lseek(inFd, 0, SEEK_CUR) == 0 && ::lseek(outFd, 0, SEEK_CUR) == 0
+        && ::ioctl(outFd, FICLONE, inFd) == 0) {
+        if (usedMethod) {
+            *usedMethod = Reflink;
+        }
+        return true;
+    }
+
+    // copy_file_range: in-kernel copy, server-side on NFS 4.2
+    // Both descriptors advance, so any fallback below continues where this stops
+    for (;;) {
+        ssize_t copied = ::copy_file_range(inFd, nullptr, outFd, nullptr, kKernelCopyChunk, 0);
+        if (copied > 0) {
+            continue;
+        }
+        if (copied == 0) {
+            if (usedMethod) {
+                *usedMethod = CopyFileRange;
+            }
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!isUnsupported(errno)) {
+            return false;
+        }
+        break;
+    }
+
+    // sendfile: still in-kernel, works across filesystems
+    for (;;) {
+        ssize_t copied = ::sendfile(outFd, inFd, nullptr, kKernelCopyChunk);
+        if (copied > 0) {
+            continue;
+        }
+        if (copied == 0) {
+            if (usedMethod) {
+                *usedMethod = SendFile;
+            }
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!isUnsupported(errno)) {
+            return false;
+        }
+        break;
+    }
+#endif
+
+    if (usedMethod) {
+        *usedMethod = Buffered;
+    }
+    return copyBuffered(inFd, outFd);
+#else
+    Q_UNUSED(inFd)
+    Q_UNUSED(outFd)
+    Q_UNUSED(usedMethod)
+    return false;
+#endif
+}
+
+bool FastFileCopy::copyFile(const QString &source, const QString &dest, QString *errorString)
+{
+#ifdef Q_OS_UNIX
+    int inFd = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    if (inFd < 0) {
+        if (errorString) {
+            *errorString = "无法打开源文件: " + QString::fromLocal8Bit(strerror(errno));
+        }
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(inFd, &st) != 0) {
+        if (errorString) {
+            *errorString = "无法读取源文件信息: " + QString::fromLocal8Bit(strerror(errno));
+        }
+        ::close(inFd);
+        return false;
+    }
+
+    int outFd = ::open(QFile::encodeName(dest).constData(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (outFd < 0) {
+        if (errorString) {
+            *errorString = "无法打开目标文件: " + QString::fromLocal8Bit(strerror(errno));
+        }
+        ::close(inFd);
+        return false;
+    }
+
+    bool ok = copyDescriptor(inFd, outFd);
+    if (!ok && errorString) {
+        *errorString = "文件写入不完整: " + QString::fromLocal8Bit(strerror(errno));
+    }
+
+    ::close(inFd);
+    if (::close(outFd) != 0 && ok) {
+        ok = false;
+        if (errorString) {
+            *errorString = "文件写入不完整: " + QString::fromLocal8Bit(strerror(errno));
+        }
+    }
+
+    return ok;
+#else
+    // QFile::copy uses the platform copy primitive (CopyFileEx on Windows)
+    QFile::remove(dest);
+    QFile file(source);
+    if (!file.copy(dest)) {
+        if (errorString) {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    return true;
+#endif
+}
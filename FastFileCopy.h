@@ -0,0 +1,30 @@
+#ifndef FASTFILECOPY_H
+#define FASTFILECOPY_H
+
+#include <QString>
+
+// 零拷贝文件复制
+// Tries, in order: a FICLONE reflink (instant on btrfs/xfs), in-kernel
+// copy_file_range, sendfile, and finally a bounded buffered loop. Memory use
+// is constant whatever the file size.
+class FastFileCopy
+{
+public:
+    enum Method {
+        Reflink,
+        CopyFileRange,
+        SendFile,
+        Buffered
+    };
+
+    // Copy everything from the current offset of inFd to outFd (POSIX only)
+    static bool copyDescriptor(int inFd, int outFd, Method *usedMethod = nullptr);
+
+    // Copy a file by path, replacing the destination; permissions are preserved
+    static bool copyFile(const QString &source, const QString &dest, QString *errorString = nullptr);
+
+    // Size of the bounce buffer used by the buffered fallback
+    static const int BufferSize = 1024 * 1024;
+};
+
+#endif // FASTFILECOPY_H
@@ -0,0 +1,321 @@
+#include "FileCatalog.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStandardPaths>
+#include <atomic>
+
+namespace {
+
+const int kSchemaVersion = 1;
+
+// Columns returned by every query; "keys" is a comma separated list
+const char kSelectColumns[] =
+    "f.id, f.source_path, f.output_path, f.operation, f.method, f.source_size, f.output_size, "
+    "f.content_hash, f.created_at, "
+    "(SELECT group_concat(k.key_name, ',') FROM file_keys k WHERE k.file_id = f.id) AS keys";
+
+// Open connections. Each is closed by its thread on exit, or by closeConnections
+// while QCoreApplication still exists, whichever comes first.
+QMutex connectionsMutex;
+QSet<QString> openConnections;
+
+void closeConnection(const QString &name)
+{
+    QSqlDatabase::database(name, false).close();
+    QSqlDatabase::removeDatabase(name);
+}
+
+void closeConnections()
+{
+    QMutexLocker locker(&connectionsMutex);
+    for (const QString &name : openConnections) {
+        closeConnection(name);
+    }
+    openConnections.clear();
+}
+
+// Per-thread connection, removed again when the thread exits
+struct ThreadConnection
+{
+    ~ThreadConnection()
+    {
+        QMutexLocker locker(&connectionsMutex);
+        if (openConnections.remove(name)) {
+            closeConnection(name);
+        }
+    }
+
+    bool isOpen() const
+    {
+        QMutexLocker locker(&connectionsMutex);
+        return openConnections.contains(name);
+    }
+
+    QString name;
+};
+
+// Key names are stored without the .key / .aeskey suffix
+QString normalizeKeyName(const QString &keyName)
+{
+    if (keyName.endsWith(".aeskey")) {
+        return keyName.left(keyName.length() - 7);
+    }
+    if (keyName.endsWith(".key")) {
+        return keyName.left(keyName.length() - 4);
+    }
+    return keyName;
+}
+
+QVariantList rows(QSqlQuery &query)
+{
+    QVariantList result;
+    while (query.next()) {
+        QSqlRecord record = query.record();
+        QVariantMap row;
+        for (int i = 0; i < record.count(); ++i) {
+            row.insert(record.fieldName(i), record.value(i));
+        }
+        result.append(row);
+    }
+    return result;
+}
+
+} // namespace
+
+FileCatalog &FileCatalog::instance()
+{
+    static FileCatalog catalog;
+    return catalog;
+}
+
+FileCatalog::FileCatalog()
+{
+    QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dataPath);
+    m_path = dataPath + "/catalog.sqlite";
+
+    // Thread-local connections of long-lived threads would otherwise be torn
+    // down after the application object (and the SQL driver) is gone
+    qAddPostRoutine(closeConnections);
+}
+
+QString FileCatalog::databasePath() const
+{
+    return m_path;
+}
+
+QSqlDatabase FileCatalog::database()
+{
+    static std::atomic<int> connectionCounter(0);
+    static thread_local ThreadConnection connection;
+
+    if (!connection.name.isEmpty() && connection.isOpen()) {
+        return QSqlDatabase::database(connection.name, false);
+    }
+
+    QString name = QString("file_catalog_%1").arg(connectionCounter.fetch_add(1));
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+    db.setDatabaseName(m_path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    connection.name = name;
+    {
+        QMutexLocker locker(&connectionsMutex);
+        openConnections.insert(name);
+    }
+
+    if (!db.open()) {
+        qDebug() << "无法打开文件目录数据库:" << db.lastError().text();
+        return db;
+    }
+
+    // WAL: readers never block the writer, and commits are a sequential append
+    QSqlQuery pragma(db);
+    pragma.exec("PRAGMA journal_mode=WAL");
+    pragma.exec("PRAGMA synchronous=NORMAL");
+    pragma.exec("PRAGMA foreign_keys=ON");
+
+    if (!createSchema(db)) {
+        qDebug() << "无法创建文件目录表:" << db.lastError().text();
+    }
+
+    return db;
+}
+
+bool FileCatalog::createSchema(QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if (query.exec("PRAGMA user_version") && query.next() && query.value(0).toInt() >= kSchemaVersion) {
+        return true;
+    }
+
+    const char *statements[] = {
+        "CREATE TABLE IF NOT EXISTS files ("
+        " id INTEGER PRIMARY KEY,"
+        " source_path TEXT NOT NULL,"
+        " output_path TEXT NOT NULL,"
+        " operation TEXT NOT NULL,"
+        " method TEXT NOT NULL,"
+        " source_size INTEGER NOT NULL,"
+        " output_size INTEGER NOT NULL,"
+        " content_hash TEXT,"
+        " created_at INTEGER NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS file_keys ("
+        " key_name TEXT NOT NULL,"
+        " file_id INTEGER NOT NULL REFERENCES files(id) ON DELETE CASCADE,"
+        " PRIMARY KEY (key_name, file_id)) WITHOUT ROWID",
+        "CREATE INDEX IF NOT EXISTS idx_files_output ON files(output_path)",
+        "CREATE INDEX IF NOT EXISTS idx_files_source ON files(source_path)",
+        "CREATE INDEX IF NOT EXISTS idx_files_hash ON files(content_hash)",
+        "CREATE INDEX IF NOT EXISTS idx_file_keys_file ON file_keys(file_id)",
+    };
+
+    db.transaction();
+    for (const char *statement : statements) {
+        if (!query.exec(QString::fromLatin1(statement))) {
+            db.rollback();
+            return false;
+        }
+    }
+    query.exec(QString("PRAGMA user_version=%1").arg(kSchemaVersion));
+    return db.commit();
+}
+
+bool FileCatalog::record(const Entry &entry)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    db.transaction();
+
+    QSqlQuery insert(db);
+    insert.prepare("INSERT INTO files (source_path, output_path, operation, method, source_size, "
+                   "output_size, content_hash, created_at) VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    insert.addBindValue(QDir::cleanPath(QFileInfo(entry.sourcePath).absoluteFilePath()));
+    insert.addBindValue(QDir::cleanPath(QFileInfo(entry.outputPath).absoluteFilePath()));
+    insert.addBindValue(entry.operation);
+    insert.addBindValue(entry.method);
+    insert.addBindValue(entry.sourceSize);
+    insert.addBindValue(entry.outputSize);
+    insert.addBindValue(entry.contentHash.isEmpty() ? QVariant() : QVariant(QString::fromLatin1(entry.contentHash.toHex())));
+    insert.addBindValue(QDateTime::currentMSecsSinceEpoch());
+
+    if (!insert.exec()) {
+        qDebug() << "文件目录写入失败:" << insert.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    qint64 fileId = insert.lastInsertId().toLongLong();
+    QSqlQuery keyInsert(db);
+    keyInsert.prepare("INSERT OR IGNORE INTO file_keys (key_name, file_id) VALUES (?, ?)");
+    for (const QString &keyName : entry.keyNames) {
+        keyInsert.addBindValue(normalizeKeyName(keyName));
+        keyInsert.addBindValue(fileId);
+        if (!keyInsert.exec()) {
+            qDebug() << "文件目录写入失败:" << keyInsert.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    return db.commit();
+}
+
+bool FileCatalog::replaceKey(const QString &outputPath, const QString &oldKeyName, const QString &newKeyName)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    // All encrypt rows for this output describe the file now on disk
+    QSqlQuery query(db);
+    query.prepare("UPDATE OR REPLACE file_keys SET key_name = ? WHERE key_name = ? AND file_id IN "
+                  "(SELECT id FROM files WHERE output_path = ? AND operation = 'encrypt')");
+    query.addBindValue(normalizeKeyName(newKeyName));
+    query.addBindValue(normalizeKeyName(oldKeyName));
+    query.addBindValue(QDir::cleanPath(QFileInfo(outputPath).absoluteFilePath()));
+    return query.exec();
+}
+
+QVariantList FileCatalog::filesForKey(const QString &keyName, int limit)
+{
+    QSqlDatabase db = database();
+    QSqlQuery query(db);
+    query.prepare(QString("SELECT %1 FROM file_keys k0 JOIN files f ON f.id = k0.file_id "
+                          "WHERE k0.key_name = ? ORDER BY k0.file_id DESC LIMIT ?").arg(kSelectColumns));
+    query.addBindValue(normalizeKeyName(keyName));
+    query.addBindValue(limit);
+    query.exec();
+    return rows(query);
+}
+
+QVariantList FileCatalog::findByOutput(const QString &outputPath)
+{
+    QSqlDatabase db = database();
+    QSqlQuery query(db);
+    query.prepare(QString("SELECT %1 FROM files f WHERE f.output_path = ? ORDER BY f.id DESC")
+                  .arg(kSelectColumns));
+    query.addBindValue(QDir::cleanPath(QFileInfo(outputPath).absoluteFilePath()));
+    query.exec();
+    return rows(query);
+}
+
+QVariantList FileCatalog::findByHash(const QString &hexHash, int limit)
+{
+    QSqlDatabase db = database();
+    QSqlQuery query(db);
+    query.prepare(QString("SELECT %1 FROM files f WHERE f.content_hash = ? ORDER BY f.id DESC LIMIT ?")
+                  .arg(kSelectColumns));
+    query.addBindValue(hexHash.toLower());
+    query.addBindValue(limit);
+    query.exec();
+    return rows(query);
+}
+
+QVariantList FileCatalog::findByPathPrefix(const QString &prefix, int limit)
+{
+    // The prefix is a directory (or a single file): the path itself, and
+    // everything below "<path>/" - never siblings such as "/data/ab" for "/data/a".
+    // Range scans on the path indexes instead of LIKE, which could not use them.
+    // U+10FFFF sorts after every other character in SQLite's binary collation.
+    QString path = QDir::cleanPath(QFileInfo(prefix).absoluteFilePath());
+    QString from = path.endsWith('/') ? path : path + '/';
+    QString to = from + QString::fromUcs4(U"\U0010FFFF");
+
+    QSqlDatabase db = database();
+    QSqlQuery query(db);
+    query.prepare(QString("SELECT %1 FROM files f WHERE f.id IN ("
+                          "SELECT id FROM files WHERE source_path = ? OR (source_path >= ? AND source_path < ?) "
+                          "UNION SELECT id FROM files WHERE output_path = ? OR (output_path >= ? AND output_path < ?)) "
+                          "ORDER BY f.id DESC LIMIT ?").arg(kSelectColumns));
+    for (int column = 0; column < 2; ++column) {
+        query.addBindValue(path);
+        query.addBindValue(from);
+        query.addBindValue(to);
+    }
+    query.addBindValue(limit);
+    query.exec();
+    return rows(query);
+}
+
+qint64 FileCatalog::count()
+{
+    QSqlDatabase db = database();
+    QSqlQuery query(db);
+    if (query.exec("SELECT count(*) FROM files") && query.next()) {
+        return query.value(0).toLongLong();
+    }
+    return 0;
+}
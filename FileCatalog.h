@@ -0,0 +1,64 @@
+#ifndef FILECATALOG_H
+#define FILECATALOG_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <QVariantMap>
+
+class QSqlDatabase;
+
+// 加密文件目录
+// Local SQLite database (WAL mode) that the crypto core writes on every
+// successful file operation: source and output path, method, key names,
+// sizes, timestamp and the SHA-256 of the plaintext. Every lookup is served by
+// an index, so queries stay in the millisecond range with millions of rows.
+// Safe to use from any thread; each thread gets its own connection. All
+// connections are closed when QCoreApplication is destroyed.
+class FileCatalog
+{
+public:
+    struct Entry
+    {
+        QString sourcePath;
+        QString outputPath;
+        QString operation;      // "encrypt" / "decrypt"
+        QString method;         // "aes", "rsa", "hybrid"
+        QStringList keyNames;   // empty for password mode
+        qint64 sourceSize = 0;
+        qint64 outputSize = 0;
+        QByteArray contentHash; // SHA-256 of the plaintext, raw bytes
+    };
+
+    static FileCatalog &instance();
+
+    // Record one operation; failures are logged, never fatal for the caller
+    bool record(const Entry &entry);
+
+    // Replace oldKeyName with newKeyName for the file at outputPath (key rotation)
+    bool replaceKey(const QString &outputPath, const QString &oldKeyName, const QString &newKeyName);
+
+    // Queries, newest first. Rows are maps with the column names as keys.
+    QVariantList filesForKey(const QString &keyName, int limit = 1000);
+    QVariantList findByOutput(const QString &outputPath);
+    QVariantList findByHash(const QString &hexHash, int limit = 1000);
+    // Files at prefix or anywhere below it as a directory
+    QVariantList findByPathPrefix(const QString &prefix, int limit = 1000);
+    qint64 count();
+
+    QString databasePath() const;
+
+private:
+    FileCatalog();
+    FileCatalog(const FileCatalog &) = delete;
+    FileCatalog &operator=(const FileCatalog &) = delete;
+
+    // This thread's connection, opened and migrated on first use
+    QSqlDatabase database();
+    bool createSchema(QSqlDatabase &db);
+
+    QString m_path;
+};
+
+#endif // FILECATALOG_H
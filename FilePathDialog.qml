@@ -0,0 +1,68 @@
+import QtQuick 2.15
+import QtQuick.Window 2.15
+import QtQuick.Controls 2.15
+import QtQuick.Layouts 1.15
+
+// 手动输入文件路径的备用对话框（由EnDeCode按需通过Loader加载）
+Window {
+    id: fileInputDialog
+    title: "输入文件路径"
+    width: 500
+    height: 200
+    flags: Qt.Dialog | Qt.WindowCloseButtonHint
+    modality: Qt.ApplicationModal
+    visible: false
+
+    function open() {
+        visible = true;
+    }
+
+    function close() {
+        visible = false;
+    }
+
+    // 用户输入的完整路径，由EnDeCode导入到文件列表
+    signal pathAccepted(string path)
+
+    function accept() {
+        if (filePathInput.text.length > 0) {
+            pathAccepted(filePathInput.text);
+        }
+        filePathInput.text = "";
+        close();
+    }
+
+    ColumnLayout {
+        anchors.fill: parent
+        anchors.margins: 20
+        spacing: 20
+
+        Text {
+            text: "请输入文件的完整路径:"
+            font.pixelSize: 14
+        }
+
+        TextField {
+            id: filePathInput
+            Layout.fillWidth: true
+            placeholderText: "例如: /home/user/documents/file.txt"
+            selectByMouse: true
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            spacing: 10
+            Layout.alignment: Qt.AlignRight
+
+            Button {
+                text: "取消"
+                onClicked: fileInputDialog.close()
+            }
+
+            Button {
+                text: "确定"
+                onClicked: fileInputDialog.accept()
+            }
+        }
+    }
+}
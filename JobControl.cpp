@@ -0,0 +1,121 @@
+#include "JobControl.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <openssl/crypto.h>
+
+void JobControl::cancel()
+{
+    // Lock-free so it can be called from a signal handler; a paused job
+    // notices within PollMs
+    m_cancelled.store(true);
+}
+
+void JobControl::pause()
+{
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(true);
+}
+
+void JobControl::resume()
+{
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(false);
+    m_resumed.wakeAll();
+}
+
+void JobControl::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled.store(false);
+    m_paused.store(false);
+    m_resumed.wakeAll();
+}
+
+bool JobControl::proceed()
+{
+    // Fast path: one relaxed load per chunk when nobody touches the job
+    if (!m_paused.load(std::memory_order_relaxed)) {
+        return !isCancelled();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    while (m_paused.load() && !m_cancelled.load()) {
+        m_resumed.wait(&m_mutex, PollMs);
+    }
+    return !m_cancelled.load();
+}
+
+QString JobCheckpoint::checkpointPath(const QString &outputFile)
+{
+    return outputFile + ".checkpoint";
+}
+
+QString JobCheckpoint::partPath(const QString &outputFile)
+{
+    return outputFile + ".part";
+}
+
+bool JobCheckpoint::save(const QString &outputFile) const
+{
+    QJsonObject data;
+    data["input_file"] = inputFile;
+    data["input_size"] = inputSize;
+    data["input_modified"] = inputModified;
+    data["method"] = method;
+    data["key_names"] = QJsonArray::fromStringList(keyNames);
+    data["input_offset"] = inputOffset;
+    data["output_offset"] = outputOffset;
+    data["last_block"] = QString(lastBlock.toBase64());
+
+    // Restrict the temporary file before anything is written to it
+    QSaveFile file(checkpointPath(outputFile));
+    if (!file.open(QIODevice::WriteOnly)
+        || !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)) {
+        return false;
+    }
+
+    file.write(QJsonDocument(data).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+bool JobCheckpoint::load(const QString &outputFile)
+{
+    QFile file(checkpointPath(outputFile));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray json = file.readAll();
+    QJsonObject data = QJsonDocument::fromJson(json).object();
+    OPENSSL_cleanse(json.data(), json.size());
+    // Earlier versions stored the file key here; such a checkpoint is
+    // rejected so the caller discards it
+    if (data.isEmpty() || data.contains("key")) {
+        return false;
+    }
+
+    inputFile = data["input_file"].toString();
+    inputSize = qint64(data["input_size"].toDouble());
+    inputModified = qint64(data["input_modified"].toDouble());
+    method = data["method"].toString();
+    keyNames.clear();
+    for (const QJsonValue &name : data["key_names"].toArray()) {
+        keyNames.append(name.toString());
+    }
+    inputOffset = qint64(data["input_offset"].toDouble());
+    outputOffset = qint64(data["output_offset"].toDouble());
+    lastBlock = QByteArray::fromBase64(data["last_block"].toString().toLatin1());
+
+    return lastBlock.size() == 16 && inputOffset >= 0 && inputOffset <= inputSize
+           && inputOffset % 16 == 0 && outputOffset > 0;
+}
+
+void JobCheckpoint::discard(const QString &outputFile)
+{
+    QFile::remove(checkpointPath(outputFile));
+    QFile::remove(partPath(outputFile));
+}
@@ -0,0 +1,91 @@
+#ifndef JOBCONTROL_H
+#define JOBCONTROL_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+#include <atomic>
+
+// 任务控制：取消 / 暂停 / 继续
+// Token shared by a CryptoManager and the work it runs. Chunk loops and batch
+// workers call proceed() between units of work: it blocks while the job is
+// paused and returns false once it has been cancelled. Thread-safe; cancel()
+// is also async-signal-safe.
+class JobControl
+{
+public:
+    void cancel();
+    void pause();
+    void resume();
+
+    // Clear cancel/pause
+    void reset();
+
+    // Scope of one public operation. The state is cleared when the outermost
+    // operation ends, not when it starts, so a cancel() issued from another
+    // thread just before the operation got going still stops it.
+    class Run
+    {
+    public:
+        explicit Run(JobControl &job) : m_job(job) { m_job.m_running.fetch_add(1); }
+        ~Run()
+        {
+            if (m_job.m_running.fetch_sub(1) == 1) {
+                m_job.reset();
+            }
+        }
+
+    private:
+        Run(const Run &) = delete;
+        Run &operator=(const Run &) = delete;
+        JobControl &m_job;
+    };
+
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+    bool isPaused() const { return m_paused.load(std::memory_order_relaxed); }
+
+    bool proceed();
+
+    static const unsigned long PollMs = 100;
+
+private:
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<bool> m_paused{false};
+    std::atomic<int> m_running{0};
+    QMutex m_mutex;
+    QWaitCondition m_resumed;
+};
+
+// 断点续传检查点
+// Sidecar "<output>.checkpoint" of a resumable encryption into "<output>.part".
+// It holds what is needed to continue the CBC stream: the input offset, the
+// durable output length and the last ciphertext block (the next IV). The file
+// key is never stored: a resumed job derives it again from the password and
+// the header at the start of the .part file. It is only written after the
+// output was synced, is owner-readable only and is removed when the job
+// completes.
+struct JobCheckpoint
+{
+    QString inputFile;
+    qint64 inputSize = 0;
+    qint64 inputModified = 0;
+    QString method;
+    QStringList keyNames;
+
+    qint64 inputOffset = 0;
+    qint64 outputOffset = 0;
+    QByteArray lastBlock;
+
+    static QString checkpointPath(const QString &outputFile);
+    static QString partPath(const QString &outputFile);
+
+    bool save(const QString &outputFile) const;
+    bool load(const QString &outputFile);
+
+    // Remove the checkpoint and the partial output
+    static void discard(const QString &outputFile);
+};
+
+#endif // JOBCONTROL_H
@@ -0,0 +1,114 @@
+#include "JobScheduler.h"
+#include "CryptoMetrics.h"
+#include "MemoryBudget.h"
+#include <QThread>
+
+namespace {
+
+// Threads outside the pools (GUI, CLI) run what the user is waiting for
+thread_local JobScheduler::Priority threadPriority = JobScheduler::Interactive;
+
+// Upper bound for one wait, so a missed wake-up only costs this much
+const unsigned long kYieldPollMs = 50;
+
+} // namespace
+
+JobScheduler &JobScheduler::instance()
+{
+    static JobScheduler scheduler;
+    return scheduler;
+}
+
+JobScheduler::JobScheduler()
+{
+    for (std::atomic<int> &active : m_active) {
+        active.store(0);
+    }
+
+    // CPU-bound work: one thread per core; I/O mostly waits, so oversubscribe
+    m_cpuPool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+    m_ioPool.setMaxThreadCount(qBound(4, QThread::idealThreadCount() * 2, 32));
+}
+
+QThreadPool *JobScheduler::pool(Resource resource)
+{
+    return resource == Io ? &m_ioPool : &m_cpuPool;
+}
+
+void JobScheduler::submit(const std::function<void()> &task, Priority priority, Resource resource)
+{
+    // QThreadPool starts higher numbers first. A per-command trace follows its
+    // work onto the pool threads.
+    std::shared_ptr<CryptoMetrics::Trace> trace = CryptoMetrics::currentTrace();
+    pool(resource)->start([this, task, priority, trace]() {
+        Scope scope(priority);
+        CryptoMetrics::TraceScope traceScope(trace);
+        yieldPoint();
+        task();
+    }, int(PriorityCount) - int(priority));
+}
+
+JobScheduler::Priority JobScheduler::currentPriority()
+{
+    return threadPriority;
+}
+
+JobScheduler::Scope::Scope(Priority priority)
+    : m_priority(priority),
+      m_previous(threadPriority)
+{
+    threadPriority = priority;
+    JobScheduler::instance().enter(priority);
+}
+
+JobScheduler::Scope::~Scope()
+{
+    JobScheduler::instance().leave(m_priority);
+    threadPriority = m_previous;
+}
+
+void JobScheduler::enter(Priority priority)
+{
+    m_active[priority].fetch_add(1);
+}
+
+void JobScheduler::leave(Priority priority)
+{
+    if (m_active[priority].fetch_sub(1) == 1 && priority != Background) {
+        // Lower classes may be parked on this one
+        QMutexLocker locker(&m_mutex);
+        m_idle.wakeAll();
+    }
+}
+
+bool JobScheduler::higherPriorityActive(Priority priority) const
+{
+    for (int p = 0; p < int(priority); ++p) {
+        if (m_active[p].load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobScheduler::yieldPoint()
+{
+    // Fast path: a couple of relaxed loads per chunk
+    Priority priority = threadPriority;
+    if (priority == Interactive || !higherPriorityActive(priority)) {
+        return;
+    }
+
+    // The caller may hold memory the higher class is waiting for: parking
+    // then would block both, so keep going until the waiter is admitted
+    MemoryBudget &budget = MemoryBudget::instance();
+    QMutexLocker locker(&m_mutex);
+    while (higherPriorityActive(priority) && !budget.hasWaiters()) {
+        m_idle.wait(&m_mutex, kYieldPollMs);
+    }
+}
+
+int JobScheduler::activeCount(Priority priority) const
+{
+    return m_active[priority].load();
+}
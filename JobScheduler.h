@@ -0,0 +1,78 @@
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <atomic>
+#include <functional>
+
+// 任务调度器
+// Priority classes for crypto work, and the process-wide CPU and I/O worker
+// pools. Queued tasks start in priority order; running work is preempted at
+// chunk granularity: every chunk loop calls yieldPoint(), which parks the
+// thread while work of a higher class is active. A file the user clicks on
+// (Interactive) therefore runs at about its standalone latency even while a
+// bulk batch (Normal) or background job keeps every core busy.
+//
+// Threads the scheduler does not own (the GUI thread, CLI main thread) count as
+// Interactive; tasks run at the class they were submitted with.
+class JobScheduler
+{
+public:
+    enum Priority {
+        Interactive = 0,
+        Normal = 1,
+        Background = 2,
+        PriorityCount
+    };
+
+    enum Resource {
+        Cpu, // cipher, RSA, KDF: one thread per core
+        Io   // hashing and copying, mostly waiting on the disk: oversubscribed
+    };
+
+    static JobScheduler &instance();
+
+    void submit(const std::function<void()> &task, Priority priority, Resource resource = Cpu);
+    QThreadPool *pool(Resource resource);
+
+    // Class of the work running on the calling thread
+    static Priority currentPriority();
+
+    // Marks the calling thread's work as active at a priority for its lifetime
+    class Scope
+    {
+    public:
+        explicit Scope(Priority priority = currentPriority());
+        ~Scope();
+
+    private:
+        Priority m_priority;
+        Priority m_previous;
+    };
+
+    // Call between chunks: returns at once unless higher-priority work is active
+    // (and nobody waits for MemoryBudget, see there)
+    void yieldPoint();
+
+    int activeCount(Priority priority) const;
+
+private:
+    JobScheduler();
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler &operator=(const JobScheduler &) = delete;
+
+    void enter(Priority priority);
+    void leave(Priority priority);
+    bool higherPriorityActive(Priority priority) const;
+
+    QThreadPool m_cpuPool;
+    QThreadPool m_ioPool;
+
+    std::atomic<int> m_active[PriorityCount];
+    QMutex m_mutex;
+    QWaitCondition m_idle;
+};
+
+#endif // JOBSCHEDULER_H
@@ -0,0 +1,110 @@
+#include "KdfParams.h"
+#include <openssl/evp.h>
+
+namespace {
+
+// Bounds accepted from files, so a crafted header cannot make us spin or exhaust memory
+const quint32 kMinPbkdf2Iterations = 1000;
+const quint32 kMaxPbkdf2Iterations = KdfParams::MaxPbkdf2Iterations;
+const quint32 kMinScryptLogN = 10;
+const quint32 kMaxScryptLogN = 22;
+const quint64 kMaxScryptMemory = quint64(1) << 30; // 1 GiB
+
+quint64 scryptMemory(quint32 logN, quint32 r, quint32 p)
+{
+    // 128 * r * N for V plus 128 * r * p for B, with headroom
+    return 128ull * r * ((quint64(1) << logN) + p) + 1024 * 1024;
+}
+
+} // namespace
+
+bool KdfParams::isValid() const
+{
+    switch (algorithm) {
+    case Pbkdf2Sha256:
+        return cost >= kMinPbkdf2Iterations && cost <= kMaxPbkdf2Iterations;
+    case Scrypt:
+        return cost >= kMinScryptLogN && cost <= kMaxScryptLogN
+               && blockSize >= 1 && blockSize <= 32
+               && parallelism >= 1 && parallelism <= 16
+               && scryptMemory(cost, blockSize, parallelism) <= kMaxScryptMemory;
+    default:
+        return false;
+    }
+}
+
+bool KdfParams::operator==(const KdfParams &other) const
+{
+    if (algorithm != other.algorithm || cost != other.cost) {
+        return false;
+    }
+    return algorithm != Scrypt
+           || (blockSize == other.blockSize && parallelism == other.parallelism);
+}
+
+bool KdfParams::derive(const QByteArray &password, const unsigned char *salt, int saltLength,
+                       unsigned char *key, int keyLength) const
+{
+    if (!isValid()) {
+        return false;
+    }
+
+    if (algorithm == Scrypt) {
+        return EVP_PBE_scrypt(password.constData(), password.size(),
+                              salt, saltLength,
+                              quint64(1) << cost, blockSize, parallelism,
+                              scryptMemory(cost, blockSize, parallelism),
+                              key, keyLength) == 1;
+    }
+
+    return PKCS5_PBKDF2_HMAC(password.constData(), password.size(),
+                             salt, saltLength,
+                             int(cost), EVP_sha256(),
+                             keyLength, key) == 1;
+}
+
+QJsonObject KdfParams::toJson() const
+{
+    QJsonObject object;
+    object["algorithm"] = algorithmName();
+    if (algorithm == Scrypt) {
+        object["log2_n"] = qint64(cost);
+        object["r"] = qint64(blockSize);
+        object["p"] = qint64(parallelism);
+    } else {
+        object["iterations"] = qint64(cost);
+    }
+    return object;
+}
+
+KdfParams KdfParams::fromJson(const QJsonObject &object)
+{
+    KdfParams params;
+    if (object.isEmpty()) {
+        return params;
+    }
+
+    params.algorithm = algorithmFromName(object["algorithm"].toString());
+    if (params.algorithm == Scrypt) {
+        params.cost = quint32(object["log2_n"].toInt());
+        params.blockSize = quint32(object["r"].toInt(8));
+        params.parallelism = quint32(object["p"].toInt(1));
+    } else {
+        params.cost = quint32(object["iterations"].toInt());
+    }
+
+    return params.isValid() ? params : legacy();
+}
+
+QString KdfParams::algorithmName() const
+{
+    return algorithm == Scrypt ? "scrypt" : "pbkdf2-sha256";
+}
+
+int KdfParams::algorithmFromName(const QString &name)
+{
+    if (name.compare("scrypt", Qt::CaseInsensitive) == 0) {
+        return Scrypt;
+    }
+    return Pbkdf2Sha256;
+}
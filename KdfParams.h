@@ -0,0 +1,44 @@
+#ifndef KDFPARAMS_H
+#define KDFPARAMS_H
+
+#include <QJsonObject>
+#include <QString>
+
+// 密钥派生参数
+// Stored with every password-encrypted file and every AES key, so the cost can
+// be raised later without breaking old data. Anything written before the
+// parameters were recorded uses legacy(): PBKDF2-HMAC-SHA256, 10000 iterations.
+struct KdfParams
+{
+    enum Algorithm {
+        Pbkdf2Sha256 = 1,
+        Scrypt = 2
+    };
+
+    int algorithm = Pbkdf2Sha256;
+    quint32 cost = 10000;    // PBKDF2 iterations, or log2(N) for scrypt
+    quint32 blockSize = 8;   // scrypt r
+    quint32 parallelism = 1; // scrypt p
+
+    // Highest PBKDF2 iteration count accepted from a file header; calibration
+    // never writes more, so every file we produce stays readable
+    static const quint32 MaxPbkdf2Iterations = 10000000;
+
+    static KdfParams legacy() { return KdfParams(); }
+
+    bool isValid() const;
+    bool operator==(const KdfParams &other) const;
+
+    // Derive keyLength bytes into key; false on invalid parameters
+    bool derive(const QByteArray &password, const unsigned char *salt, int saltLength,
+                unsigned char *key, int keyLength) const;
+
+    QJsonObject toJson() const;
+    // Missing or malformed "kdf" objects mean legacy()
+    static KdfParams fromJson(const QJsonObject &object);
+
+    QString algorithmName() const;
+    static int algorithmFromName(const QString &name);
+};
+
+#endif // KDFPARAMS_H
@@ -20,6 +20,14 @@ Item {
 
         onOperationComplete: {
             root.showStatus(message)
+        }
+    }
+
+    // 密钥在任意界面增删后都会通知这里刷新
+    Connections {
+        target: CryptoService
+
+        function onKeysChanged() {
             refreshKeyList()
         }
     }
@@ -620,8 +628,9 @@ Item {
                                             return
                                         }
 
-                                        deleteConfirmDialog.keyName = keyModel.get(keyListView.currentIndex).name
-                                        deleteConfirmDialog.open()
+                                        deleteConfirmLoader.active = true
+                                        deleteConfirmLoader.item.keyName = keyModel.get(keyListView.currentIndex).name
+                                        deleteConfirmLoader.item.open()
                                     }
                                 }
                             }
@@ -747,79 +756,18 @@ Item {
         root.showStatus(message)
     }
 
-    // Delete confirmation dialog
-    Window {
-        id: deleteConfirmDialog
-        width: 400
-        height: 200
-        flags: Qt.Dialog | Qt.WindowCloseButtonHint
-        modality: Qt.ApplicationModal
-        visible: false
-        title: "确认删除"
-        x: parent ? (parent.width - width) / 2 : 0
-        y: parent ? (parent.height - height) / 2 : 0
-
-        property string keyName: ""
-
-        function open() {
-            visible = true;
-        }
-
-        function close() {
-            visible = false;
-        }
-
-        ColumnLayout {
-            anchors.fill: parent
-            anchors.margins: 20
-            spacing: 20
-
-            Text {
-                Layout.fillWidth: true
-                text: "确定要删除密钥 \"" + deleteConfirmDialog.keyName + "\" 吗？此操作不可撤销。"
-                wrapMode: Text.WordWrap
-                font.pixelSize: 16
-                color: "#394149"
-            }
-
-            RowLayout {
-                Layout.fillWidth: true
-                spacing: 10
-
-                Button {
-                    Layout.fillWidth: true
-                    text: "取消"
-                    font.pixelSize: 16
-
-                    onClicked: {
-                        deleteConfirmDialog.close()
-                    }
-                }
-
-                Button {
-                    Layout.fillWidth: true
-                    text: "删除"
-                    font.pixelSize: 16
-
-                    background: Rectangle {
-                        radius: 5
-                        color: "#E74C3C"
-                    }
+    // Delete confirmation dialog, created the first time a key is deleted
+    Loader {
+        id: deleteConfirmLoader
+        active: false
+        source: "DeleteKeyDialog.qml"
+    }
 
-                    contentItem: Text {
-                        text: parent.text
-                        font: parent.font
-                        color: "white"
-                        horizontalAlignment: Text.AlignHCenter
-                        verticalAlignment: Text.AlignVCenter
-                    }
+    Connections {
+        target: deleteConfirmLoader.item
 
-                    onClicked: {
-                        directoryHandler.deleteKey(deleteConfirmDialog.keyName)
-                        deleteConfirmDialog.close()
-                    }
-                }
-            }
+        function onConfirmed(keyName) {
+            directoryHandler.deleteKey(keyName)
         }
     }
 }
@@ -0,0 +1,85 @@
+#include "LegacyXorDevice.h"
+#include <cstring>
+
+const char LegacyXorDevice::EmptyMarker[] = "EMPTY_FILE_MARKER";
+
+LegacyXorDevice::LegacyXorDevice(const QString &path, const QByteArray &key, QObject *parent)
+    : QIODevice(parent),
+      m_file(path),
+      m_key(key)
+{
+}
+
+bool LegacyXorDevice::open(OpenMode mode)
+{
+    // An empty key never produced a file: the legacy code divides by its length
+    if ((mode & ReadWrite) != ReadOnly || m_key.isEmpty()) {
+        return false;
+    }
+    if (!m_file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        setErrorString(m_file.errorString());
+        return false;
+    }
+
+    // Exactly the marker. The legacy decoder compared only 16 bytes and never
+    // recognised it, so those files decoded to garbage instead of empty.
+    const qint64 markerLength = qint64(sizeof(EmptyMarker)) - 1;
+    if (m_file.size() == markerLength) {
+        QByteArray head = m_file.read(markerLength);
+        m_emptyMarker = head.size() == markerLength && memcmp(head.constData(), EmptyMarker, size_t(markerLength)) == 0;
+        m_file.seek(0);
+    }
+
+    // Unbuffered: reads go straight to readData in whole chunks
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void LegacyXorDevice::close()
+{
+    QIODevice::close();
+    m_file.close();
+    m_emptyMarker = false;
+}
+
+qint64 LegacyXorDevice::size() const
+{
+    return m_emptyMarker ? 0 : m_file.size();
+}
+
+bool LegacyXorDevice::seek(qint64 pos)
+{
+    if (m_emptyMarker) {
+        return pos == 0 && QIODevice::seek(pos);
+    }
+    return m_file.seek(pos) && QIODevice::seek(pos);
+}
+
+qint64 LegacyXorDevice::readData(char *data, qint64 maxSize)
+{
+    if (m_emptyMarker) {
+        return 0;
+    }
+
+    const qint64 position = m_file.pos();
+    qint64 bytesRead = m_file.read(data, maxSize);
+    if (bytesRead <= 0) {
+        return bytesRead;
+    }
+
+    // Byte i of the file was XORed with key[i % keyLength]
+    const char *key = m_key.constData();
+    const int keyLength = m_key.size();
+    int keyIndex = int(position % keyLength);
+    for (qint64 i = 0; i < bytesRead; ++i) {
+        data[i] ^= key[keyIndex];
+        if (++keyIndex == keyLength) {
+            keyIndex = 0;
+        }
+    }
+    return bytesRead;
+}
+
+qint64 LegacyXorDevice::writeData(const char *, qint64)
+{
+    return -1;
+}
@@ -0,0 +1,39 @@
+#ifndef LEGACYXORDEVICE_H
+#define LEGACYXORDEVICE_H
+
+#include <QFile>
+#include <QIODevice>
+
+// 旧版XOR文件读取
+// Read-only view of a file written by DirectoryHandler::enCodeFile that
+// yields the plaintext: the bytes are XORed with the repeating key as they
+// are read, so a legacy file can feed an encryption stream directly, with no
+// plaintext copy on disk. Random access works (the key phase follows pos()).
+//
+// Files produced from empty inputs hold only EmptyMarker; they read as empty.
+class LegacyXorDevice : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    LegacyXorDevice(const QString &path, const QByteArray &key, QObject *parent = nullptr);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return false; }
+    qint64 size() const override;
+    bool seek(qint64 pos) override;
+
+    static const char EmptyMarker[];
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QFile m_file;
+    QByteArray m_key;
+    bool m_emptyMarker = false;
+};
+
+#endif // LEGACYXORDEVICE_H
@@ -0,0 +1,121 @@
+#include "MemoryBudget.h"
+#include "JobControl.h"
+#include <QSettings>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+namespace {
+
+// Never throttle below a few streams' worth of buffers
+const qint64 kMinimumLimit = qint64(64) << 20;
+
+qint64 physicalMemory()
+{
+#if defined(Q_OS_WIN)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return qint64(status.ullTotalPhys);
+    }
+#elif defined(_SC_PHYS_PAGES)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0) {
+        return qint64(pages) * pageSize;
+    }
+#endif
+    return qint64(4) << 30;
+}
+
+} // namespace
+
+MemoryBudget &MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget()
+{
+    QSettings settings;
+    setLimit(settings.value("memory/budgetMB", 0).toLongLong() << 20);
+}
+
+qint64 MemoryBudget::defaultLimit()
+{
+    // Leaves the rest for the page cache, the UI and other processes
+    return qMax(kMinimumLimit, physicalMemory() / 4);
+}
+
+void MemoryBudget::setLimit(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_limit = bytes > 0 ? qMax(bytes, kMinimumLimit) : defaultLimit();
+    m_released.wakeAll();
+}
+
+qint64 MemoryBudget::limit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_limit;
+}
+
+qint64 MemoryBudget::inUse() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_inUse;
+}
+
+qint64 MemoryBudget::peak() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_peak;
+}
+
+bool MemoryBudget::reserve(qint64 bytes, JobControl *job)
+{
+    QMutexLocker locker(&m_mutex);
+    if (bytes > m_limit) {
+        return false;
+    }
+    if (m_inUse + bytes > m_limit) {
+        // Parked holders keep running until this one is admitted
+        m_waiting.fetch_add(1);
+        while (m_inUse + bytes > m_limit) {
+            // The limit may also shrink while waiting
+            if (bytes > m_limit || (job && job->isCancelled())) {
+                m_waiting.fetch_sub(1);
+                return false;
+            }
+            m_released.wait(&m_mutex, JobControl::PollMs);
+        }
+        m_waiting.fetch_sub(1);
+    }
+    m_inUse += bytes;
+    m_peak = qMax(m_peak, m_inUse);
+    return true;
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_inUse -= bytes;
+    m_released.wakeAll();
+}
+
+MemoryBudget::Reservation::Reservation(qint64 bytes, JobControl *job)
+    : m_bytes(MemoryBudget::instance().reserve(bytes, job) ? bytes : -1)
+{
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    if (m_bytes > 0) {
+        MemoryBudget::instance().release(m_bytes);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+
+class JobControl;
+
+// 内存预算
+// Process-wide cap on the memory held by in-flight crypto work. Every stream
+// reserves its working set (chunk buffers) before it starts and returns it
+// when done; a reservation that would exceed the budget blocks until others
+// finish, so a heavy batch slows down instead of growing without bound.
+//
+// The default is a quarter of physical memory; "memory/budgetMB" in QSettings
+// overrides it. Whole-file buffers (previews, thumbnails) are charged too; a
+// reservation larger than the whole budget is refused rather than admitted.
+//
+// Streams hold their reservation across JobScheduler::yieldPoint(). So that a
+// parked low-priority stream cannot starve the higher-priority job waiting for
+// its memory, yieldPoint() does not park while a reservation is waiting.
+class MemoryBudget
+{
+public:
+    static MemoryBudget &instance();
+
+    // Bytes; 0 restores the default
+    void setLimit(qint64 bytes);
+    qint64 limit() const;
+
+    qint64 inUse() const;
+    qint64 peak() const;
+
+    static qint64 defaultLimit();
+
+    // A reservation is blocked waiting for memory
+    bool hasWaiters() const { return m_waiting.load(std::memory_order_relaxed) > 0; }
+
+    // Holds bytes of the budget for its lifetime. Waiting gives up when the
+    // job is cancelled, and more than limit() bytes are never granted;
+    // isValid() then returns false and nothing is held.
+    class Reservation
+    {
+    public:
+        explicit Reservation(qint64 bytes, JobControl *job = nullptr);
+        ~Reservation();
+
+        bool isValid() const { return m_bytes >= 0; }
+
+        Reservation(const Reservation &) = delete;
+        Reservation &operator=(const Reservation &) = delete;
+
+    private:
+        qint64 m_bytes;
+    };
+
+private:
+    MemoryBudget();
+    MemoryBudget(const MemoryBudget &) = delete;
+    MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+    bool reserve(qint64 bytes, JobControl *job);
+    void release(qint64 bytes);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_released;
+    qint64 m_limit = 0;
+    qint64 m_inUse = 0;
+    qint64 m_peak = 0;
+    std::atomic<int> m_waiting{0};
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,147 @@
+#include "PageCacheAdvisor.h"
+#include "BufferPool.h"
+#include <QFileDevice>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+PageCacheAdvisor::PageCacheAdvisor(QIODevice *device, Role role, Mode mode)
+    : m_device(device),
+      m_role(role),
+      m_mode(mode)
+{
+    QFileDevice *file = qobject_cast<QFileDevice *>(device);
+    if (mode == Cached || !file || !file->isOpen()) {
+        m_mode = Cached;
+        return;
+    }
+    m_fd = file->handle();
+    m_dropped = m_flushed = device->pos();
+
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_SEQUENTIAL)
+    if (m_fd >= 0 && role == Input) {
+        // Larger readahead, and a hint that nothing read here is needed again
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_NOREUSE);
+    }
+#endif
+}
+
+PageCacheAdvisor::~PageCacheAdvisor()
+{
+    if (m_fd < 0) {
+        return;
+    }
+    if (m_role == Output) {
+        // Starts writeback of the dirty tail and drops whatever is already clean
+        dropOutput(false);
+    } else {
+        advance();
+    }
+    setDirect(false);
+}
+
+void PageCacheAdvisor::setDirect(bool enabled)
+{
+#if defined(Q_OS_LINUX) && defined(O_DIRECT)
+    if (enabled == m_direct) {
+        return;
+    }
+    int flags = fcntl(m_fd, F_GETFL);
+    if (flags >= 0 && fcntl(m_fd, F_SETFL, enabled ? flags | O_DIRECT : flags & ~O_DIRECT) == 0) {
+        m_direct = enabled;
+    } else if (enabled) {
+        // Not supported by this file system (tmpfs, some FUSE): stay buffered
+        m_mode = DropBehind;
+    }
+#else
+    Q_UNUSED(enabled)
+#endif
+}
+
+void PageCacheAdvisor::prepare()
+{
+    if (m_fd < 0 || m_mode != Direct || m_role != Input) {
+        return;
+    }
+    // A short read at EOF leaves the offset unaligned; O_DIRECT would then fail with EINVAL
+    setDirect(m_device->pos() % BufferPool::Alignment == 0);
+}
+
+void PageCacheAdvisor::advance()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    const qint64 position = m_device->pos();
+    if (m_role == Output) {
+#ifdef Q_OS_LINUX
+        // Start writeback of what was just written; wait for and drop the window before it
+        if (position > m_flushed) {
+            sync_file_range(m_fd, m_flushed, position - m_flushed, SYNC_FILE_RANGE_WRITE);
+            m_flushed = position;
+        }
+        if (m_flushed - m_dropped >= 2 * WriteBehindWindow) {
+            dropOutput(true);
+        }
+#else
+        m_flushed = position;
+        if (m_flushed - m_dropped >= WriteBehindWindow) {
+            dropOutput(false);
+        }
+#endif
+        return;
+    }
+
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_DONTNEED)
+    if (position > m_dropped) {
+        posix_fadvise(m_fd, m_dropped, position - m_dropped, POSIX_FADV_DONTNEED);
+        m_dropped = position;
+    }
+#endif
+}
+
+void PageCacheAdvisor::dropOutput(bool wait)
+{
+    // Clean pages only: anything still under writeback stays cached until the next call
+    qint64 end = wait ? m_flushed - WriteBehindWindow : m_flushed;
+    if (end <= m_dropped) {
+        return;
+    }
+#ifdef Q_OS_LINUX
+    if (wait) {
+        sync_file_range(m_fd, m_dropped, end - m_dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+#endif
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(m_fd, m_dropped, end - m_dropped, POSIX_FADV_DONTNEED);
+#endif
+    m_dropped = end;
+}
+
+PageCacheAdvisor::Mode PageCacheAdvisor::modeFromName(const QString &name)
+{
+    if (name == "drop-behind") {
+        return DropBehind;
+    }
+    if (name == "direct") {
+        return Direct;
+    }
+    return Cached;
+}
+
+QString PageCacheAdvisor::modeName(Mode mode)
+{
+    switch (mode) {
+    case DropBehind:
+        return "drop-behind";
+    case Direct:
+        return "direct";
+    default:
+        return "cached";
+    }
+}
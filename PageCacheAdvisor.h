@@ -0,0 +1,67 @@
+#ifndef PAGECACHEADVISOR_H
+#define PAGECACHEADVISOR_H
+
+#include <QString>
+
+class QIODevice;
+
+// 页缓存策略（批量模式）
+// Keeps a sequential pass over large files from evicting everyone else's page
+// cache. Attach one to each side of a stream and call advance() after every
+// chunk:
+//   DropBehind - consumed input is dropped with POSIX_FADV_DONTNEED; written
+//                output is pushed to disk a window behind the writer
+//                (sync_file_range on Linux) and then dropped, so dirty pages
+//                never pile up either.
+//   Direct     - as DropBehind, and reads bypass the cache entirely with
+//                O_DIRECT while the file offset is block aligned (pooled
+//                buffers and chunk sizes already are). Writes keep going
+//                through the cache: outputs start with an unaligned header.
+// Devices without a file descriptor, and platforms without the calls, are
+// left alone.
+class PageCacheAdvisor
+{
+public:
+    enum Mode {
+        Cached,
+        DropBehind,
+        Direct
+    };
+
+    enum Role {
+        Input,
+        Output
+    };
+
+    PageCacheAdvisor(QIODevice *device, Role role, Mode mode);
+    ~PageCacheAdvisor();
+
+    PageCacheAdvisor(const PageCacheAdvisor &) = delete;
+    PageCacheAdvisor &operator=(const PageCacheAdvisor &) = delete;
+
+    // Before a read: O_DIRECT only while the offset is aligned
+    void prepare();
+
+    // After a chunk was read or written
+    void advance();
+
+    static Mode modeFromName(const QString &name);
+    static QString modeName(Mode mode);
+
+    // Output written but not yet flushed and dropped
+    static const qint64 WriteBehindWindow = qint64(8) << 20;
+
+private:
+    void setDirect(bool enabled);
+    void dropOutput(bool wait);
+
+    QIODevice *m_device;
+    Role m_role;
+    Mode m_mode;
+    int m_fd = -1;
+    bool m_direct = false;
+    qint64 m_dropped = 0; // everything before this offset has been dropped
+    qint64 m_flushed = 0; // writeback started up to here (output only)
+};
+
+#endif // PAGECACHEADVISOR_H
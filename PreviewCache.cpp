@@ -0,0 +1,132 @@
+#include "PreviewCache.h"
+#include "JobScheduler.h"
+#include "MemoryBudget.h"
+#include <QBuffer>
+#include <QDateTime>
+#include <QFileInfo>
+#include <climits>
+
+#include <openssl/crypto.h>
+
+PreviewCache &PreviewCache::instance()
+{
+    static PreviewCache cache;
+    return cache;
+}
+
+PreviewCache::PreviewCache()
+    : m_cache(int(DefaultCapacity >> 10))
+{
+}
+
+bool PreviewCache::setCredentials(const QString &keyName, const QString &password, QString &error)
+{
+    // Unlock outside the lock: the KDF takes a while
+    CryptoManager::DecryptionKeys keys;
+    if (!m_crypto.unlockDecryptionKeys(keyName, password, keys, error)) {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    OPENSSL_cleanse(m_keys.privateKey.data(), m_keys.privateKey.size());
+    m_keys = keys;
+    ++m_generation;
+    m_cache.clear();
+    return true;
+}
+
+void PreviewCache::clearCredentials()
+{
+    QMutexLocker locker(&m_mutex);
+    OPENSSL_cleanse(m_keys.privateKey.data(), m_keys.privateKey.size());
+    m_keys = CryptoManager::DecryptionKeys();
+    ++m_generation;
+    m_cache.clear();
+}
+
+CryptoManager::DecryptionKeys PreviewCache::credentials() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_keys;
+}
+
+QByteArray PreviewCache::plaintext(const QString &path, QString &error)
+{
+    QFileInfo info(path);
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    CryptoManager::DecryptionKeys keys;
+    quint64 generation = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry *entry = m_cache.object(path);
+        if (entry && entry->modified == modified && entry->size == info.size()) {
+            return entry->data;
+        }
+        keys = m_keys;
+        generation = m_generation;
+    }
+
+    // The whole plaintext is buffered: bounded, and charged to the memory
+    // budget while it is built
+    if (info.size() > MaxPreviewSize) {
+        OPENSSL_cleanse(keys.privateKey.data(), keys.privateKey.size());
+        error = "File is too large to preview";
+        return QByteArray();
+    }
+    MemoryBudget::Reservation memory(info.size());
+    if (!memory.isValid()) {
+        OPENSSL_cleanse(keys.privateKey.data(), keys.privateKey.size());
+        error = "File is too large to preview";
+        return QByteArray();
+    }
+
+    // Sized up front: the plaintext is at most the ciphertext size, so the
+    // buffer never reallocates while the stream writes into it
+    QByteArray data;
+    data.reserve(int(info.size()));
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QByteArray contentHash;
+    bool ok = m_crypto.decryptToDevice(path, keys, &buffer, contentHash, error);
+    buffer.close();
+    OPENSSL_cleanse(keys.privateKey.data(), keys.privateKey.size());
+    if (!ok) {
+        return QByteArray();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    // Larger than the whole cache: returned, but not kept
+    if (generation == m_generation && data.size() / 1024 < m_cache.maxCost()) {
+        m_cache.insert(path, new Entry{ data, modified, info.size() }, qMax(1, data.size() / 1024));
+    }
+    return data;
+}
+
+void PreviewCache::requestText(const QString &path)
+{
+    JobScheduler::instance().submit([this, path]() {
+        QString error;
+        QByteArray data = plaintext(path, error);
+        emit textReady(path, QString::fromUtf8(data.constData(), qMin(data.size(), MaxTextBytes)), error);
+    }, JobScheduler::Interactive);
+}
+
+void PreviewCache::setCapacity(qint64 bytes)
+{
+    // QCache counts in int: costs are kept in KiB
+    QMutexLocker locker(&m_mutex);
+    m_cache.setMaxCost(int(qBound<qint64>(1, bytes >> 10, INT_MAX)));
+}
+
+qint64 PreviewCache::capacity() const
+{
+    QMutexLocker locker(&m_mutex);
+    return qint64(m_cache.maxCost()) << 10;
+}
+
+void PreviewCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cache.clear();
+}
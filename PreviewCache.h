@@ -0,0 +1,66 @@
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QObject>
+#include "CryptoManager.h"
+
+// 解密预览缓存（仅内存）
+// Decrypts encrypted files straight into memory for previews, so nothing is
+// written to disk and no plaintext copy is left for clearTempFiles. Decrypted
+// contents are kept in an LRU bounded by bytes; an entry is dropped when the
+// file changes. Keys are unlocked once per setCredentials and kept until
+// clearCredentials, which also empties the cache.
+//
+// plaintext() blocks and is meant for worker threads; requestText() runs on
+// the scheduler at Interactive priority and answers through textReady.
+class PreviewCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    static PreviewCache &instance();
+
+    // Empty keyName: password (AES) files; otherwise hybrid/RSA with that key
+    bool setCredentials(const QString &keyName, const QString &password, QString &error);
+    void clearCredentials();
+    // Copy of the unlocked keys, for caches that follow the same credentials
+    CryptoManager::DecryptionKeys credentials() const;
+
+    QByteArray plaintext(const QString &path, QString &error);
+
+    void requestText(const QString &path);
+
+    void setCapacity(qint64 bytes);
+    qint64 capacity() const;
+    void clear();
+
+    static const qint64 DefaultCapacity = qint64(256) << 20;
+    // Larger files are not previewed: the whole plaintext would be buffered
+    static const qint64 MaxPreviewSize = qint64(128) << 20;
+    // Text previews stop after this many bytes
+    static const int MaxTextBytes = 1024 * 1024;
+
+signals:
+    void textReady(const QString &path, const QString &text, const QString &error);
+
+private:
+    PreviewCache();
+
+    struct Entry
+    {
+        QByteArray data;
+        qint64 modified;
+        qint64 size;
+    };
+
+    CryptoManager m_crypto;
+
+    mutable QMutex m_mutex;
+    CryptoManager::DecryptionKeys m_keys;
+    quint64 m_generation = 0; // bumped by credential changes; stale results are not cached
+    QCache<QString, Entry> m_cache; // cost = decrypted bytes
+};
+
+#endif // PREVIEWCACHE_H
@@ -0,0 +1,640 @@
+#include "StorageTuner.h"
+#include "JobScheduler.h"
+#include "PageCacheAdvisor.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileDevice>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMap>
+#include <QSettings>
+#include <QStorageInfo>
+#include <QTemporaryFile>
+#include <QThreadPool>
+
+#include <openssl/rand.h>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kProfilesKey[] = "storage/profiles";
+const char kAutoCalibrateKey[] = "storage/autoCalibrate";
+
+// Settings within this fraction of the best throughput count as equal; the
+// smaller chunk (less memory) or fewer readers (less seeking) then wins
+const double kChunkTolerance = 0.95;
+const double kDepthTolerance = 0.90;
+
+// A background probe that other work disturbed is run again, up to this often
+const int kProbeAttempts = 5;
+
+// Directory -> mount lookups kept before the cache starts over
+const int kMaxCachedMounts = 4096;
+
+// A scratch file this old was left behind by a run that did not finish
+const int kStaleScratchSecs = 3600;
+
+// Smaller streams and batches mostly measure open and metadata cost
+const qint64 kMinSampleBytes = qint64(16) << 20;
+// Fewer files never keep the larger candidate depths busy
+const int kMinBatchFiles = 2 * StorageTuner::MaxQueueDepth;
+
+QList<int> chunkCandidates()
+{
+    QList<int> candidates;
+    for (int chunkSize = StorageTuner::MinChunkSize; chunkSize <= StorageTuner::MaxChunkSize; chunkSize *= 4) {
+        candidates.append(chunkSize);
+    }
+    return candidates;
+}
+
+QList<int> depthCandidates()
+{
+    QList<int> candidates;
+    for (int depth = 1; depth <= StorageTuner::MaxQueueDepth; depth *= 2) {
+        candidates.append(depth);
+    }
+    return candidates;
+}
+
+double samplesMBps(const StorageProfile::Sample &sample)
+{
+    return double(sample.bytes) / (1024.0 * 1024.0) * 1e9 / double(qMax<qint64>(sample.nanos, 1));
+}
+
+// The candidate with the fewest observed bytes, so all of them get their turn
+int leastObserved(const QMap<int, StorageProfile::Sample> &samples, const QList<int> &candidates)
+{
+    int least = candidates.first();
+    for (int candidate : candidates) {
+        if (samples.value(candidate).bytes < samples.value(least).bytes) {
+            least = candidate;
+        }
+    }
+    return least;
+}
+
+// Add a sample. Once every candidate has ObservedBytes, the samples are
+// dropped and the smallest candidate within tolerance of the best returned
+// (its throughput in mbps); 0 until then
+int observe(QMap<int, StorageProfile::Sample> &samples, const QList<int> &candidates, double tolerance,
+            int value, qint64 bytes, qint64 nanos, double &mbps)
+{
+    if (!candidates.contains(value)) {
+        return 0;
+    }
+    StorageProfile::Sample &sample = samples[value];
+    sample.bytes += bytes;
+    sample.nanos += nanos;
+
+    double best = 0;
+    for (int candidate : candidates) {
+        const StorageProfile::Sample observed = samples.value(candidate);
+        if (observed.bytes < StorageTuner::ObservedBytes) {
+            return 0;
+        }
+        best = qMax(best, samplesMBps(observed));
+    }
+    int chosen = 0;
+    for (int candidate : candidates) {
+        mbps = samplesMBps(samples.value(candidate));
+        if (mbps >= best * tolerance) {
+            chosen = candidate;
+            break;
+        }
+    }
+    samples.clear();
+    return chosen;
+}
+
+QJsonObject samplesToJson(const QMap<int, StorageProfile::Sample> &samples)
+{
+    QJsonObject json;
+    for (auto it = samples.constBegin(); it != samples.constEnd(); ++it) {
+        json[QString::number(it.key())] = QJsonArray() << double(it->bytes) << double(it->nanos);
+    }
+    return json;
+}
+
+QMap<int, StorageProfile::Sample> samplesFromJson(const QJsonObject &json)
+{
+    QMap<int, StorageProfile::Sample> samples;
+    for (auto it = json.constBegin(); it != json.constEnd(); ++it) {
+        QJsonArray values = it.value().toArray();
+        StorageProfile::Sample sample;
+        sample.bytes = qint64(values.at(0).toDouble());
+        sample.nanos = qint64(values.at(1).toDouble());
+        if (it.key().toInt() > 0 && sample.bytes > 0 && sample.nanos > 0) {
+            samples.insert(it.key().toInt(), sample);
+        }
+    }
+    return samples;
+}
+
+// Flush the scratch file and evict it, so the next probe reads from the device
+bool dropCache(QFileDevice &file)
+{
+    if (!file.flush()) {
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    int fd = file.handle();
+    if (fd >= 0) {
+        ::fsync(fd);
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+#endif
+    return true;
+}
+
+// Sequential read of [offset, offset + length) in chunkSize reads
+bool readRange(const QString &path, qint64 offset, qint64 length, int chunkSize)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered) || !file.seek(offset)) {
+        return false;
+    }
+    PooledBuffer buffer = BufferPool::instance().acquire(chunkSize);
+    if (buffer.isNull()) {
+        return false;
+    }
+
+    // O_DIRECT where the file system has it, else read and drop
+    PageCacheAdvisor cache(&file, PageCacheAdvisor::Input, PageCacheAdvisor::Direct);
+    while (length > 0) {
+        cache.prepare();
+        qint64 bytesRead = file.read(buffer.data(), qMin<qint64>(chunkSize, length));
+        if (bytesRead <= 0) {
+            return false;
+        }
+        length -= bytesRead;
+        cache.advance();
+    }
+    return true;
+}
+
+// Aggregate MB/s of readers reading disjoint slices of the scratch file in parallel
+double readThroughput(QFile &scratch, int readers, int chunkSize)
+{
+    if (!dropCache(scratch)) {
+        return 0;
+    }
+
+    const QString path = scratch.fileName();
+    const qint64 slice = StorageTuner::ScratchSize / readers;
+    std::atomic<bool> ok(true);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(readers);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < readers; ++i) {
+        pool.start([&, i]() {
+            if (!readRange(path, i * slice, slice, chunkSize)) {
+                ok.store(false);
+            }
+        });
+    }
+    pool.waitForDone();
+    qint64 elapsedNs = qMax<qint64>(timer.nsecsElapsed(), 1);
+
+    if (!ok.load()) {
+        return 0;
+    }
+    return double(StorageTuner::ScratchSize) / (1024.0 * 1024.0) * 1e9 / double(elapsedNs);
+}
+
+bool writeScratch(QFile &scratch)
+{
+    // Random data: compressing or deduplicating file systems must not shortcut the probe
+    PooledBuffer buffer = BufferPool::instance().acquire(StorageTuner::MaxChunkSize);
+    if (buffer.isNull() || RAND_bytes(buffer.bytes(), buffer.size()) != 1) {
+        return false;
+    }
+
+    PageCacheAdvisor cache(&scratch, PageCacheAdvisor::Output, PageCacheAdvisor::DropBehind);
+    for (qint64 written = 0; written < StorageTuner::ScratchSize; written += buffer.size()) {
+        if (scratch.write(buffer.constData(), buffer.size()) != buffer.size()) {
+            return false;
+        }
+        cache.advance();
+    }
+    return dropCache(scratch);
+}
+
+} // namespace
+
+std::atomic<bool> StorageTuner::s_background(false);
+
+QJsonObject StorageProfile::toJson() const
+{
+    QJsonObject json;
+    json["device"] = device;
+    json["fileSystem"] = fileSystem;
+    json["chunkSize"] = chunkSize;
+    json["queueDepth"] = queueDepth;
+    json["readMBps"] = readMBps;
+    json["calibrated"] = calibrated;
+    json["adapted"] = adapted;
+    if (!chunkSamples.isEmpty()) {
+        json["chunkSamples"] = samplesToJson(chunkSamples);
+    }
+    if (!depthSamples.isEmpty()) {
+        json["depthSamples"] = samplesToJson(depthSamples);
+    }
+    return json;
+}
+
+StorageProfile StorageProfile::fromJson(const QJsonObject &json)
+{
+    StorageProfile profile;
+    profile.device = json["device"].toString();
+    profile.fileSystem = json["fileSystem"].toString();
+    profile.chunkSize = qBound(StorageTuner::MinChunkSize, json["chunkSize"].toInt(BufferPool::ChunkSize),
+                               StorageTuner::MaxChunkSize);
+    profile.queueDepth = qBound(0, json["queueDepth"].toInt(), StorageTuner::MaxQueueDepth);
+    profile.readMBps = json["readMBps"].toDouble();
+    profile.calibrated = qint64(json["calibrated"].toDouble());
+    profile.adapted = qint64(json["adapted"].toDouble());
+    profile.chunkSamples = samplesFromJson(json["chunkSamples"].toObject());
+    profile.depthSamples = samplesFromJson(json["depthSamples"].toObject());
+    return profile;
+}
+
+bool StorageProfile::hasData() const
+{
+    return hasChunkSize() || queueDepth > 0 || !chunkSamples.isEmpty() || !depthSamples.isEmpty();
+}
+
+StorageTuner &StorageTuner::instance()
+{
+    static StorageTuner tuner;
+    return tuner;
+}
+
+StorageTuner::StorageTuner()
+{
+    QSettings settings;
+    m_autoCalibrate = settings.value(kAutoCalibrateKey, false).toBool();
+
+    QJsonObject profiles = QJsonDocument::fromJson(settings.value(kProfilesKey).toString().toUtf8()).object();
+    for (auto it = profiles.constBegin(); it != profiles.constEnd(); ++it) {
+        StorageProfile profile = StorageProfile::fromJson(it.value().toObject());
+        profile.mountPoint = it.key();
+        if (profile.hasData()) {
+            m_profiles.insert(it.key(), profile);
+        }
+    }
+}
+
+StorageProfile StorageTuner::mountOf(const QString &directory)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto mount = m_mounts.constFind(directory);
+        if (mount != m_mounts.constEnd()) {
+            return m_profiles.value(mount.value());
+        }
+    }
+
+    QStorageInfo storage(directory);
+    StorageProfile current;
+    current.mountPoint = storage.isValid() ? storage.rootPath() : QDir::rootPath();
+    current.device = QString::fromUtf8(storage.device());
+    current.fileSystem = QString::fromUtf8(storage.fileSystemType());
+
+    QMutexLocker locker(&m_mutex);
+    if (m_mounts.size() >= kMaxCachedMounts) {
+        m_mounts.clear();
+    }
+    m_mounts.insert(directory, current.mountPoint);
+
+    // A profile measured on another device mounted at the same place is stale
+    auto known = m_profiles.find(current.mountPoint);
+    if (known != m_profiles.end() && known->device == current.device) {
+        return known.value();
+    }
+    m_profiles.insert(current.mountPoint, current);
+    return current;
+}
+
+StorageProfile StorageTuner::profile(const QString &path)
+{
+    QFileInfo info(path);
+    QString directory = info.isDir() ? info.absoluteFilePath() : info.absolutePath();
+    StorageProfile profile = mountOf(directory);
+
+    if (!profile.isCalibrated() && !profile.mountPoint.isEmpty()) {
+        scheduleCalibration(directory, profile.mountPoint);
+    }
+    return profile;
+}
+
+int StorageTuner::chunkSize(const QIODevice *device)
+{
+    const QFileDevice *file = qobject_cast<const QFileDevice *>(device);
+    if (!file || file->fileName().isEmpty()) {
+        return BufferPool::ChunkSize;
+    }
+    StorageProfile mount = profile(file->fileName());
+    if (mount.hasChunkSize() || mount.mountPoint.isEmpty()) {
+        return mount.chunkSize;
+    }
+    return leastObserved(mount.chunkSamples, chunkCandidates());
+}
+
+int StorageTuner::batchDepth(const QStringList &files, bool *measure)
+{
+    if (measure) {
+        *measure = false;
+    }
+
+    QSet<QString> directories;
+    for (const QString &file : files) {
+        directories.insert(QFileInfo(file).absolutePath());
+    }
+
+    int depth = 0;
+    for (const QString &directory : directories) {
+        int mountDepth = profile(directory).queueDepth;
+        if (mountDepth > 0) {
+            depth = depth > 0 ? qMin(depth, mountDepth) : mountDepth;
+        }
+    }
+    if (depth > 0 || files.size() < kMinBatchFiles) {
+        return depth;
+    }
+
+    // A large batch on one untuned mount tries one of the candidate depths
+    const QString mountPoint = commonMount(files);
+    if (mountPoint.isEmpty()) {
+        return 0;
+    }
+    QMutexLocker locker(&m_mutex);
+    auto mount = m_profiles.constFind(mountPoint);
+    if (mount == m_profiles.constEnd() || mount->queueDepth > 0) {
+        return 0;
+    }
+    if (measure) {
+        *measure = true;
+    }
+    return leastObserved(mount->depthSamples, depthCandidates());
+}
+
+QString StorageTuner::commonMount(const QStringList &files)
+{
+    QSet<QString> directories;
+    for (const QString &file : files) {
+        directories.insert(QFileInfo(file).absolutePath());
+    }
+
+    QString mountPoint;
+    for (const QString &directory : directories) {
+        QString mount = mountOf(directory).mountPoint;
+        if (mountPoint.isEmpty()) {
+            mountPoint = mount;
+        } else if (mount != mountPoint) {
+            return QString();
+        }
+    }
+    return mountPoint;
+}
+
+void StorageTuner::recordStream(const QIODevice *device, int chunkSize, qint64 bytes, qint64 readNanos)
+{
+    const QFileDevice *file = qobject_cast<const QFileDevice *>(device);
+    if (!file || file->fileName().isEmpty() || bytes < kMinSampleBytes || readNanos <= 0) {
+        return;
+    }
+    const QString mountPoint = mountOf(QFileInfo(file->fileName()).absolutePath()).mountPoint;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto mount = m_profiles.find(mountPoint);
+        if (mount == m_profiles.end() || mount->hasChunkSize()) {
+            return;
+        }
+        double mbps = 0;
+        int chosen = observe(mount->chunkSamples, chunkCandidates(), kChunkTolerance, chunkSize, bytes, readNanos, mbps);
+        if (chosen > 0) {
+            mount->chunkSize = chosen;
+            mount->readMBps = mbps;
+            mount->adapted = QDateTime::currentMSecsSinceEpoch();
+            qDebug() << "存储块大小已按实际吞吐选定:" << mountPoint << chosen;
+        }
+    }
+    save();
+}
+
+void StorageTuner::recordBatch(const QStringList &files, int depth, qint64 bytes, qint64 nanos)
+{
+    if (files.size() < kMinBatchFiles || bytes < kMinSampleBytes || nanos <= 0) {
+        return;
+    }
+    const QString mountPoint = commonMount(files);
+    if (mountPoint.isEmpty()) {
+        return;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto mount = m_profiles.find(mountPoint);
+        if (mount == m_profiles.end() || mount->queueDepth > 0) {
+            return;
+        }
+        double mbps = 0;
+        int chosen = observe(mount->depthSamples, depthCandidates(), kDepthTolerance, depth, bytes, nanos, mbps);
+        if (chosen > 0) {
+            mount->queueDepth = chosen;
+            qDebug() << "存储并发深度已按实际吞吐选定:" << mountPoint << chosen;
+        }
+    }
+    save();
+}
+
+void StorageTuner::scheduleCalibration(const QString &directory, const QString &mountPoint)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_autoCalibrate || !s_background.load() || m_scheduled.contains(mountPoint)) {
+            return;
+        }
+        m_scheduled.insert(mountPoint);
+    }
+
+    // Read-only and nearly full mounts keep the defaults
+    QFileInfo info(directory);
+    if (!info.isWritable() || QStorageInfo(directory).bytesAvailable() < 4 * ScratchSize) {
+        return;
+    }
+
+    // Background: parked while anything the user started is running
+    JobScheduler::instance().submit([this, directory]() {
+        StorageProfile result;
+        QString error;
+        if (!calibrate(directory, result, error)) {
+            qDebug() << "存储校准失败:" << directory << error;
+        }
+    }, JobScheduler::Background, JobScheduler::Io);
+}
+
+bool StorageTuner::calibrate(const QString &directory, StorageProfile &result, QString &error)
+{
+    QFileInfo info(directory);
+    if (!info.isDir()) {
+        error = "Not a directory: " + directory;
+        return false;
+    }
+    const QString absolute = info.absoluteFilePath();
+    if (QStorageInfo(absolute).bytesAvailable() < 2 * ScratchSize) {
+        error = "Not enough free space to calibrate " + absolute;
+        return false;
+    }
+
+    // Scratch files of a run that crashed; a concurrent run's file is younger
+    QDir dir(absolute);
+    const QDateTime stale = QDateTime::currentDateTime().addSecs(-kStaleScratchSecs);
+    for (const QFileInfo &leftover : dir.entryInfoList(QStringList() << ".safe-calibrate-*",
+                                                       QDir::Files | QDir::Hidden | QDir::NoSymLinks)) {
+        if (leftover.lastModified() < stale) {
+            QFile::remove(leftover.absoluteFilePath());
+        }
+    }
+
+    QTemporaryFile scratch(dir.filePath(".safe-calibrate-XXXXXX"));
+    if (!scratch.open()) {
+        error = "Cannot create a scratch file in " + absolute;
+        return false;
+    }
+    if (!writeScratch(scratch)) {
+        error = "Cannot write the scratch file: " + scratch.errorString();
+        return false;
+    }
+
+    // In the background, wait for other work and measure again if any started meanwhile
+    const bool background = JobScheduler::currentPriority() == JobScheduler::Background;
+    JobScheduler &scheduler = JobScheduler::instance();
+    auto busy = [&scheduler]() {
+        return scheduler.activeCount(JobScheduler::Interactive) > 0 || scheduler.activeCount(JobScheduler::Normal) > 0;
+    };
+    auto probe = [&](int readers, int chunkSize) -> double {
+        for (int attempt = 0; attempt < kProbeAttempts; ++attempt) {
+            scheduler.yieldPoint();
+            double throughput = readThroughput(scratch, readers, chunkSize);
+            if (!background || !busy()) {
+                return throughput;
+            }
+        }
+        return 0;
+    };
+
+    // Chunk size, with a single reader
+    StorageProfile profile = mountOf(absolute);
+    double best = 0;
+    QMap<int, double> byChunk;
+    for (int chunkSize = MinChunkSize; chunkSize <= MaxChunkSize; chunkSize *= 4) {
+        double throughput = probe(1, chunkSize);
+        if (throughput <= 0) {
+            error = "Calibration read failed or was interrupted";
+            return false;
+        }
+        byChunk.insert(chunkSize, throughput);
+        best = qMax(best, throughput);
+    }
+    for (auto it = byChunk.constBegin(); it != byChunk.constEnd(); ++it) {
+        if (it.value() >= best * kChunkTolerance) {
+            profile.chunkSize = it.key();
+            break;
+        }
+    }
+
+    // Queue depth, at that chunk size
+    best = 0;
+    QMap<int, double> byDepth;
+    for (int readers = 1; readers <= MaxQueueDepth; readers *= 2) {
+        double throughput = probe(readers, profile.chunkSize);
+        if (throughput <= 0) {
+            error = "Calibration read failed or was interrupted";
+            return false;
+        }
+        byDepth.insert(readers, throughput);
+        best = qMax(best, throughput);
+    }
+    for (auto it = byDepth.constBegin(); it != byDepth.constEnd(); ++it) {
+        if (it.value() >= best * kDepthTolerance) {
+            profile.queueDepth = it.key();
+            profile.readMBps = it.value();
+            break;
+        }
+    }
+
+    profile.calibrated = QDateTime::currentMSecsSinceEpoch();
+    profile.chunkSamples.clear();
+    profile.depthSamples.clear();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_profiles.insert(profile.mountPoint, profile);
+    }
+    save();
+
+    qDebug() << "存储校准完成:" << profile.mountPoint << profile.toJson();
+    result = profile;
+    return true;
+}
+
+void StorageTuner::save()
+{
+    QJsonObject profiles;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_profiles.constBegin(); it != m_profiles.constEnd(); ++it) {
+            if (it->hasData()) {
+                profiles.insert(it.key(), it->toJson());
+            }
+        }
+    }
+    QSettings settings;
+    settings.setValue(kProfilesKey, QString::fromUtf8(QJsonDocument(profiles).toJson(QJsonDocument::Compact)));
+}
+
+void StorageTuner::setAutoCalibrate(bool enabled)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_autoCalibrate = enabled;
+    }
+    QSettings settings;
+    settings.setValue(kAutoCalibrateKey, enabled);
+}
+
+bool StorageTuner::autoCalibrate() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_autoCalibrate;
+}
+
+void StorageTuner::enableBackgroundCalibration()
+{
+    s_background.store(true);
+}
+
+void StorageTuner::reset()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_profiles.clear();
+        m_mounts.clear();
+        m_scheduled.clear();
+    }
+    QSettings settings;
+    settings.remove(kProfilesKey);
+}
@@ -0,0 +1,143 @@
+#ifndef STORAGETUNER_H
+#define STORAGETUNER_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include "BufferPool.h"
+#include <atomic>
+
+class QIODevice;
+
+// Tuning of one mount point
+struct StorageProfile
+{
+    QString mountPoint;
+    QString device;
+    QString fileSystem;
+
+    // Read size of file streams on this mount
+    int chunkSize = BufferPool::ChunkSize;
+    // Concurrent sequential readers the device still gains from; batches keep at
+    // most this many files in flight (0: not tuned yet, the pool decides)
+    int queueDepth = 0;
+
+    // Throughput measured at the chosen settings, in MB/s
+    double readMBps = 0;
+    qint64 calibrated = 0; // ms since epoch, 0 if never
+    qint64 adapted = 0;    // chunk size chosen from observed work, ms since epoch
+
+    // Throughput of real work per candidate setting, until one is chosen
+    struct Sample
+    {
+        qint64 bytes = 0;
+        qint64 nanos = 0;
+    };
+    QMap<int, Sample> chunkSamples; // by chunk size
+    QMap<int, Sample> depthSamples; // by files in flight
+
+    bool isCalibrated() const { return calibrated > 0; }
+    bool hasChunkSize() const { return calibrated > 0 || adapted > 0; }
+    // Anything worth persisting
+    bool hasData() const;
+
+    QJsonObject toJson() const;
+    static StorageProfile fromJson(const QJsonObject &json);
+};
+
+// 存储设备自动调优
+// Chunk size and parallelism of file work per mount point. NVMe, spinning
+// disks, NFS and tmpfs want very different settings, so instead of one
+// hard-coded chunk size and thread count each mount is measured once:
+// calibrate() writes a scratch file next to the data, reads it back with the
+// candidate chunk sizes and then with 1..MaxQueueDepth parallel readers
+// (bypassing the page cache where the file system allows it), and keeps the
+// smallest chunk size and reader count within a few percent of the best.
+//
+// Without a calibration the settings adapt to the work itself: streams on an
+// unknown mount take turns with the candidate chunk sizes and report their
+// read throughput (recordStream), large batches take turns with the candidate
+// depths and report theirs (recordBatch). Once every candidate has seen
+// ObservedBytes the same rule as calibration picks the setting. Samples are
+// persisted as they come, so short CLI runs add up too.
+//
+// Profiles are persisted in QSettings ("storage/profiles", keyed by mount
+// point and invalidated when a different device is mounted there). A
+// calibration replaces whatever was observed. Calibration writes its
+// scratch file into the user's directory, so it only runs when asked for
+// (calibrate-storage) or after opting in to automatic calibration: then the
+// first time work touches an unknown mount, a calibration is queued at
+// Background priority; it only runs while nothing else is active and restarts
+// a probe that was disturbed. Scratch files left by a crash are removed by the
+// next calibration of that directory.
+class StorageTuner
+{
+public:
+    static StorageTuner &instance();
+
+    // Profile of the mount holding path (defaults if not calibrated)
+    StorageProfile profile(const QString &path);
+
+    // Measure the mount holding directory and persist the result. Blocking,
+    // a few seconds on a disk; needs about ScratchSize free bytes there.
+    bool calibrate(const QString &directory, StorageProfile &result, QString &error);
+
+    // Read size for a stream over device: the profile's for files, a candidate
+    // being measured while the mount has none, else the default
+    int chunkSize(const QIODevice *device);
+
+    // In-flight file limit for a batch: the smallest queue depth among the
+    // mounts its files live on, a candidate being measured for a large batch
+    // on one untuned mount, else 0
+    // *measure is set when the batch should report back through recordBatch
+    int batchDepth(const QStringList &files, bool *measure = nullptr);
+
+    // Feedback from real work: a stream over device read bytes in readNanos
+    // with chunkSize reads; a batch of files holding bytes ran depth at a time
+    void recordStream(const QIODevice *device, int chunkSize, qint64 bytes, qint64 readNanos);
+    void recordBatch(const QStringList &files, int depth, qint64 bytes, qint64 nanos);
+
+    // Queue calibration of unknown mounts (persisted setting, default off)
+    void setAutoCalibrate(bool enabled);
+    bool autoCalibrate() const;
+
+    // Called by long-running processes (GUI, daemon); one-shot CLI runs keep
+    // the defaults rather than wait for a probe before they can exit. Does not
+    // construct the tuner, so it costs nothing at startup.
+    static void enableBackgroundCalibration();
+
+    // Drop all persisted profiles
+    void reset();
+
+    static const qint64 ScratchSize = qint64(64) << 20;
+    static const int MinChunkSize = 256 * 1024;
+    static const int MaxChunkSize = 4 * 1024 * 1024;
+    static const int MaxQueueDepth = 16;
+    // Observed bytes per candidate before a setting is chosen
+    static const qint64 ObservedBytes = qint64(256) << 20;
+
+private:
+    StorageTuner();
+    StorageTuner(const StorageTuner &) = delete;
+    StorageTuner &operator=(const StorageTuner &) = delete;
+
+    // Mount of a directory, cached: QStorageInfo re-reads the mount table
+    StorageProfile mountOf(const QString &directory);
+    // Mount shared by all files, empty if they span several
+    QString commonMount(const QStringList &files);
+    void save();
+    void scheduleCalibration(const QString &directory, const QString &mountPoint);
+
+    mutable QMutex m_mutex;
+    QHash<QString, StorageProfile> m_profiles; // by mount point
+    QHash<QString, QString> m_mounts;          // directory -> mount point
+    QSet<QString> m_scheduled;
+    bool m_autoCalibrate = false;
+    static std::atomic<bool> s_background;
+};
+
+#endif // STORAGETUNER_H
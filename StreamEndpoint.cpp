@@ -0,0 +1,128 @@
+#include "StreamEndpoint.h"
+#include "BufferPool.h"
+#include <QFile>
+#include <QLocalSocket>
+
+namespace {
+
+// Descriptor opened by QFile without taking ownership: closing the device
+// leaves stdin/stdout and inherited pipes to their owner
+QIODevice *openDescriptor(int fd, QIODevice::OpenMode mode, QString &error)
+{
+    QFile *file = new QFile;
+    if (!file->open(fd, mode | QIODevice::Unbuffered, QFileDevice::DontCloseHandle)) {
+        error = QString("Failed to open descriptor %1").arg(fd);
+        delete file;
+        return nullptr;
+    }
+    return file;
+}
+
+} // namespace
+
+bool StreamEndpoint::isStreamSpec(const QString &spec)
+{
+    return spec == "-" || spec.startsWith("fd:") || spec.startsWith("unix:");
+}
+
+QIODevice *StreamEndpoint::open(const QString &spec, QIODevice::OpenMode mode, QString &error)
+{
+    if (spec == "-") {
+        return openDescriptor(mode & QIODevice::WriteOnly ? 1 : 0, mode, error);
+    }
+
+    if (spec.startsWith("fd:")) {
+        bool ok = false;
+        int fd = spec.mid(3).toInt(&ok);
+        if (!ok || fd < 0) {
+            error = "Invalid descriptor: " + spec;
+            return nullptr;
+        }
+        return openDescriptor(fd, mode, error);
+    }
+
+    if (spec.startsWith("unix:")) {
+        QLocalSocket *socket = new QLocalSocket;
+        socket->connectToServer(spec.mid(5), mode);
+        if (!socket->waitForConnected(ConnectTimeoutMs)) {
+            error = "Failed to connect to " + spec.mid(5) + ": " + socket->errorString();
+            delete socket;
+            return nullptr;
+        }
+        SocketStream *stream = new SocketStream(socket);
+        stream->open(mode | QIODevice::Unbuffered);
+        return stream;
+    }
+
+    QFile *file = new QFile(spec);
+    if (!file->open(mode | QIODevice::Unbuffered)) {
+        error = "Failed to open " + spec;
+        delete file;
+        return nullptr;
+    }
+    return file;
+}
+
+SocketStream::SocketStream(QLocalSocket *socket, QObject *parent)
+    : QIODevice(parent),
+      m_socket(socket)
+{
+    m_socket->setParent(this);
+}
+
+SocketStream::~SocketStream()
+{
+    close();
+}
+
+void SocketStream::close()
+{
+    if (m_socket->state() == QLocalSocket::ConnectedState) {
+        // Deliver what is queued, then signal end of stream to the peer
+        m_socket->flush();
+        while (m_socket->bytesToWrite() > 0 && m_socket->waitForBytesWritten(StreamEndpoint::ConnectTimeoutMs)) {
+        }
+        m_socket->disconnectFromServer();
+    }
+    QIODevice::close();
+}
+
+qint64 SocketStream::readData(char *data, qint64 maxSize)
+{
+    qint64 total = 0;
+    while (total < maxSize) {
+        qint64 bytesRead = m_socket->read(data + total, maxSize - total);
+        if (bytesRead < 0) {
+            return total > 0 ? total : -1;
+        }
+        total += bytesRead;
+        if (total == maxSize) {
+            break;
+        }
+        // Nothing buffered: block for more, or stop at end of stream
+        if (bytesRead == 0 && !m_socket->waitForReadyRead(-1)) {
+            if (m_socket->state() != QLocalSocket::UnconnectedState
+                && m_socket->error() != QLocalSocket::PeerClosedError) {
+                return total > 0 ? total : -1;
+            }
+            break;
+        }
+    }
+    return total;
+}
+
+qint64 SocketStream::writeData(const char *data, qint64 maxSize)
+{
+    qint64 written = m_socket->write(data, maxSize);
+    if (written < 0) {
+        return -1;
+    }
+
+    // Backpressure: a slow consumer blocks the writer instead of growing the queue
+    while (m_socket->bytesToWrite() > BufferPool::ChunkSize) {
+        if (!m_socket->waitForBytesWritten(-1)) {
+            return -1;
+        }
+    }
+    return written;
+}
@@ -0,0 +1,51 @@
+#ifndef STREAMENDPOINT_H
+#define STREAMENDPOINT_H
+
+#include <QIODevice>
+#include <QString>
+
+class QLocalSocket;
+
+// 流式输入/输出端点
+// Opens the source or sink of a streaming encrypt/decrypt from a spec:
+//   "-"           stdin (read) or stdout (write)
+//   "fd:N"        an inherited descriptor, e.g. a pipe set up by the caller
+//   "unix:PATH"   a Unix domain socket (a named pipe on Windows)
+//   anything else a path; FIFOs work like regular files
+// Every device reads and writes whole buffers, blocking as needed, so the
+// crypto streams can treat a short read as end of input.
+class StreamEndpoint
+{
+public:
+    // Caller owns the device; nullptr and error on failure
+    static QIODevice *open(const QString &spec, QIODevice::OpenMode mode, QString &error);
+
+    // True for specs that are not a plain path
+    static bool isStreamSpec(const QString &spec);
+
+    static const int ConnectTimeoutMs = 10000;
+};
+
+// Blocking adapter for QLocalSocket: reads until the buffer is full or the
+// peer closes, and keeps at most one chunk queued on writes. Meant for worker
+// and CLI threads, it needs no event loop.
+class SocketStream : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit SocketStream(QLocalSocket *socket, QObject *parent = nullptr);
+    ~SocketStream() override;
+
+    bool isSequential() const override { return true; }
+    void close() override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QLocalSocket *m_socket;
+};
+
+#endif // STREAMENDPOINT_H
@@ -0,0 +1,44 @@
+#ifndef THREADDIGEST_H
+#define THREADDIGEST_H
+
+#include <openssl/evp.h>
+
+// Per-thread SHA-256 contexts, reset between files instead of reallocated.
+// A stream hashes its plaintext and its ciphertext in the same pass, so each
+// thread has one context per side.
+class ThreadDigest
+{
+public:
+    enum Slot {
+        Plaintext,
+        Ciphertext,
+        SlotCount
+    };
+
+    // Null only if OpenSSL could not allocate the context
+    static EVP_MD_CTX *context(Slot slot)
+    {
+        static thread_local Contexts contexts;
+        return contexts.ctx[slot];
+    }
+
+private:
+    struct Contexts
+    {
+        Contexts()
+        {
+            for (EVP_MD_CTX *&ctx : this->ctx) {
+                ctx = EVP_MD_CTX_new();
+            }
+        }
+        ~Contexts()
+        {
+            for (EVP_MD_CTX *ctx : this->ctx) {
+                EVP_MD_CTX_free(ctx);
+            }
+        }
+        EVP_MD_CTX *ctx[SlotCount];
+    };
+};
+
+#endif // THREADDIGEST_H
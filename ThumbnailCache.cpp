@@ -0,0 +1,402 @@
+#include "ThumbnailCache.h"
+#include "DecryptedImageProvider.h"
+#include "FileCatalog.h"
+#include "JobScheduler.h"
+#include "KdfParams.h"
+#include "MemoryBudget.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+namespace {
+
+const char kMagic[4] = { 'S', 'F', 'T', 'H' };
+const char kVersion = 1;
+const int kNonceSize = 12;
+const int kTagSize = 16;
+const int kHeaderSize = int(sizeof(kMagic)) + 1 + kNonceSize + kTagSize;
+
+// Thumbnails are a few KiB; anything much larger is not one of ours
+const qint64 kMaxEntrySize = 1024 * 1024;
+
+// Ciphertext bytes hashed for the fingerprint of files the catalog does not
+// know: the header alone carries a random salt/IV, so this is unique per file
+const int kFingerprintBytes = 4096;
+
+QByteArray hmacSha256(const QByteArray &key, const QByteArray &data)
+{
+    unsigned char mac[32];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), key.constData(), key.size(),
+         reinterpret_cast<const unsigned char*>(data.constData()), size_t(data.size()), mac, &length);
+    return QByteArray(reinterpret_cast<const char*>(mac), int(length));
+}
+
+struct CipherContext
+{
+    CipherContext() : ctx(EVP_CIPHER_CTX_new()) {}
+    ~CipherContext() { EVP_CIPHER_CTX_free(ctx); }
+    EVP_CIPHER_CTX *ctx;
+};
+
+} // namespace
+
+ThumbnailCache &ThumbnailCache::instance()
+{
+    static ThumbnailCache cache;
+    return cache;
+}
+
+QString ThumbnailCache::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails";
+}
+
+bool ThumbnailCache::isImageFile(const QString &path)
+{
+    static const QStringList suffixes = { "jpg", "jpeg", "png", "bmp", "gif", "webp", "tif", "tiff" };
+    return suffixes.contains(QFileInfo(path).suffix().toLower());
+}
+
+bool ThumbnailCache::passwordKey(const QString &password, QByteArray &key, QString &error)
+{
+    // The salt and KDF cost are fixed when the cache is first used; a later
+    // calibrateKdf does not orphan the existing thumbnails
+    QString settingsPath = directory() + "/cache.json";
+    QByteArray salt;
+    KdfParams params;
+
+    QFile file(settingsPath);
+    if (file.open(QIODevice::ReadOnly)) {
+        QJsonObject object = QJsonDocument::fromJson(file.read(64 * 1024)).object();
+        salt = QByteArray::fromHex(object.value("salt").toString().toLatin1());
+        params = KdfParams::fromJson(object.value("kdf").toObject());
+        file.close();
+    }
+
+    if (salt.size() != 16 || !params.isValid()) {
+        salt.resize(16);
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(salt.data()), salt.size()) != 1) {
+            error = "Failed to generate thumbnail cache salt";
+            return false;
+        }
+        params = CryptoManager::currentKdfParams();
+
+        QJsonObject object;
+        object.insert("salt", QString::fromLatin1(salt.toHex()));
+        object.insert("kdf", params.toJson());
+        QDir().mkpath(directory());
+        QSaveFile out(settingsPath);
+        if (!out.open(QIODevice::WriteOnly) || out.write(QJsonDocument(object).toJson()) < 0 || !out.commit()) {
+            error = "Cannot write " + settingsPath;
+            return false;
+        }
+    }
+
+    key.resize(32);
+    if (!params.derive(password.toUtf8(), reinterpret_cast<const unsigned char*>(salt.constData()), salt.size(),
+                       reinterpret_cast<unsigned char*>(key.data()), key.size())) {
+        error = "Invalid thumbnail cache KDF parameters";
+        return false;
+    }
+    return true;
+}
+
+bool ThumbnailCache::setCredentials(const CryptoManager::DecryptionKeys &keys, QString &error)
+{
+    // Derived outside the lock: the password KDF takes a while
+    QByteArray master;
+    if (!keys.privateKey.isEmpty()) {
+        master = hmacSha256(keys.privateKey, "SFTH thumbnail cache");
+    } else if (!passwordKey(keys.password, master, error)) {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    OPENSSL_cleanse(m_keys.privateKey.data(), m_keys.privateKey.size());
+    OPENSSL_cleanse(m_encryptionKey.data(), m_encryptionKey.size());
+    m_keys = keys;
+    m_encryptionKey = hmacSha256(master, "encryption");
+    m_nameKey = hmacSha256(master, "names");
+    m_failed.clear();
+    OPENSSL_cleanse(master.data(), master.size());
+    return true;
+}
+
+void ThumbnailCache::clearCredentials()
+{
+    QMutexLocker locker(&m_mutex);
+    OPENSSL_cleanse(m_keys.privateKey.data(), m_keys.privateKey.size());
+    OPENSSL_cleanse(m_encryptionKey.data(), m_encryptionKey.size());
+    m_keys = CryptoManager::DecryptionKeys();
+    m_encryptionKey.clear();
+    m_nameKey.clear();
+    m_failed.clear();
+}
+
+bool ThumbnailCache::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_encryptionKey.isEmpty();
+}
+
+QByteArray ThumbnailCache::entryId(const QString &encryptedPath) const
+{
+    QFileInfo info(encryptedPath);
+
+    // Recorded at encryption; the size check skips rows of a file since overwritten
+    for (const QVariant &row : FileCatalog::instance().findByOutput(encryptedPath)) {
+        QVariantMap entry = row.toMap();
+        QString hash = entry.value("content_hash").toString();
+        if (entry.value("operation").toString() == "encrypt" && !hash.isEmpty()) {
+            if (entry.value("output_size").toLongLong() == info.size()) {
+                return "content:" + hash.toLatin1();
+            }
+            break;
+        }
+    }
+
+    QFile file(encryptedPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QByteArray head = file.read(kFingerprintBytes);
+    QByteArray fingerprint = QCryptographicHash::hash(QByteArray::number(info.size()) + ':' + head,
+                                                      QCryptographicHash::Sha256);
+    return "cipher:" + fingerprint.toHex();
+}
+
+QString ThumbnailCache::entryName(const QByteArray &id, const QByteArray &nameKey) const
+{
+    return QString::fromLatin1(hmacSha256(nameKey, id).toHex());
+}
+
+QString ThumbnailCache::entryPath(const QString &name) const
+{
+    // 256 subdirectories keep each one small for large libraries
+    return directory() + "/" + name.left(2) + "/" + name + ".thm";
+}
+
+bool ThumbnailCache::load(const QString &name, const QByteArray &key, QImage &image) const
+{
+    QFile file(entryPath(name));
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= kHeaderSize || file.size() > kMaxEntrySize) {
+        return false;
+    }
+    QByteArray blob = file.readAll();
+    if (blob.size() <= kHeaderSize || memcmp(blob.constData(), kMagic, sizeof(kMagic)) != 0
+        || blob.at(sizeof(kMagic)) != kVersion) {
+        return false;
+    }
+
+    const unsigned char *nonce = reinterpret_cast<const unsigned char*>(blob.constData()) + sizeof(kMagic) + 1;
+    const unsigned char *tag = nonce + kNonceSize;
+    const unsigned char *cipherText = tag + kTagSize;
+    int cipherLength = blob.size() - kHeaderSize;
+    QByteArray aad = name.toLatin1();
+
+    static thread_local CipherContext cipher;
+    EVP_CIPHER_CTX *ctx = cipher.ctx;
+    QByteArray jpeg(cipherLength, Qt::Uninitialized);
+    int length = 0;
+    int finalLength = 0;
+    bool ok = ctx
+        && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, kNonceSize, nullptr) == 1
+        && EVP_DecryptInit_ex(ctx, nullptr, nullptr,
+                              reinterpret_cast<const unsigned char*>(key.constData()), nonce) == 1
+        && EVP_DecryptUpdate(ctx, nullptr, &length,
+                             reinterpret_cast<const unsigned char*>(aad.constData()), aad.size()) == 1
+        && EVP_DecryptUpdate(ctx, reinterpret_cast<unsigned char*>(jpeg.data()), &length, cipherText, cipherLength) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, kTagSize, const_cast<unsigned char*>(tag)) == 1
+        && EVP_DecryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(jpeg.data()) + length, &finalLength) == 1;
+    if (!ok) {
+        // Tampered, truncated or from another key: regenerated over it
+        return false;
+    }
+    jpeg.resize(length + finalLength);
+    return image.loadFromData(jpeg, "JPEG");
+}
+
+bool ThumbnailCache::store(const QString &name, const QByteArray &key, const QImage &image) const
+{
+    QByteArray jpeg;
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    // JPEG has no alpha; flatten onto white rather than black
+    QImage opaque = image;
+    if (image.hasAlphaChannel()) {
+        opaque = QImage(image.size(), QImage::Format_RGB32);
+        opaque.fill(Qt::white);
+        opaque.setDevicePixelRatio(image.devicePixelRatio());
+        QPainter(&opaque).drawImage(0, 0, image);
+    }
+    if (!opaque.save(&buffer, "JPEG", Quality)) {
+        return false;
+    }
+    buffer.close();
+
+    QByteArray blob(kHeaderSize + jpeg.size(), Qt::Uninitialized);
+    memcpy(blob.data(), kMagic, sizeof(kMagic));
+    blob[int(sizeof(kMagic))] = kVersion;
+    unsigned char *nonce = reinterpret_cast<unsigned char*>(blob.data()) + sizeof(kMagic) + 1;
+    unsigned char *tag = nonce + kNonceSize;
+    unsigned char *cipherText = tag + kTagSize;
+    QByteArray aad = name.toLatin1();
+
+    static thread_local CipherContext cipher;
+    EVP_CIPHER_CTX *ctx = cipher.ctx;
+    int length = 0;
+    int finalLength = 0;
+    bool ok = ctx
+        && RAND_bytes(nonce, kNonceSize) == 1
+        && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, kNonceSize, nullptr) == 1
+        && EVP_EncryptInit_ex(ctx, nullptr, nullptr,
+                              reinterpret_cast<const unsigned char*>(key.constData()), nonce) == 1
+        && EVP_EncryptUpdate(ctx, nullptr, &length,
+                             reinterpret_cast<const unsigned char*>(aad.constData()), aad.size()) == 1
+        && EVP_EncryptUpdate(ctx, cipherText, &length,
+                             reinterpret_cast<const unsigned char*>(jpeg.constData()), jpeg.size()) == 1
+        && EVP_EncryptFinal_ex(ctx, cipherText + length, &finalLength) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, kTagSize, tag) == 1;
+    OPENSSL_cleanse(jpeg.data(), jpeg.size());
+    if (!ok) {
+        return false;
+    }
+
+    QString path = entryPath(name);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(blob);
+    return file.commit();
+}
+
+bool ThumbnailCache::generateFromEncrypted(const QString &encryptedPath, const QString &name,
+                                           const CryptoManager::DecryptionKeys &keys, const QByteArray &encryptionKey,
+                                           QImage &image, QString &error)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_failed.contains(name)) {
+            error = "No thumbnail for this file";
+            return false;
+        }
+    }
+
+    // Miss: decrypt the full file into memory once, keep only the thumbnail.
+    // The buffer is bounded and charged to the memory budget.
+    qint64 size = QFileInfo(encryptedPath).size();
+    bool ok = false;
+    if (size > MaxSourceSize) {
+        error = "File is too large for a thumbnail";
+    } else {
+        MemoryBudget::Reservation memory(size);
+        if (!memory.isValid()) {
+            error = "File is too large for a thumbnail";
+        } else {
+            QByteArray data;
+            data.reserve(int(size));
+            QBuffer buffer(&data);
+            buffer.open(QIODevice::WriteOnly);
+            QByteArray contentHash;
+            ok = m_crypto.decryptToDevice(encryptedPath, keys, &buffer, contentHash, error);
+            buffer.close();
+            if (ok) {
+                buffer.open(QIODevice::ReadOnly);
+                ok = DecryptedImageProvider::decode(&buffer, QSize(Size, Size), image, error);
+            }
+            OPENSSL_cleanse(data.data(), data.size());
+        }
+    }
+
+    if (!ok) {
+        // Not retried on every scroll past the row; bounded for huge directories
+        image = QImage();
+        QMutexLocker locker(&m_mutex);
+        if (m_failed.size() >= MaxFailedEntries) {
+            m_failed.clear();
+        }
+        m_failed.insert(name);
+        return false;
+    }
+    store(name, encryptionKey, image);
+    return true;
+}
+
+QImage ThumbnailCache::thumbnail(const QString &encryptedPath, QString &error)
+{
+    CryptoManager::DecryptionKeys keys;
+    QByteArray encryptionKey;
+    QByteArray nameKey;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_encryptionKey.isEmpty()) {
+            error = "Thumbnails are locked: set a preview key first";
+            return QImage();
+        }
+        keys = m_keys;
+        encryptionKey = m_encryptionKey;
+        nameKey = m_nameKey;
+    }
+
+    QImage image;
+    QByteArray id = entryId(encryptedPath);
+    if (id.isEmpty()) {
+        error = "Cannot open file: " + encryptedPath;
+    } else {
+        QString name = entryName(id, nameKey);
+        if (!load(name, encryptionKey, image)) {
+            generateFromEncrypted(encryptedPath, name, keys, encryptionKey, image, error);
+        }
+    }
+
+    OPENSSL_cleanse(keys.privateKey.data(), keys.privateKey.size());
+    OPENSSL_cleanse(encryptionKey.data(), encryptionKey.size());
+    return image;
+}
+
+void ThumbnailCache::generate(const QString &sourcePath, const QByteArray &contentHash)
+{
+    QByteArray encryptionKey;
+    QByteArray nameKey;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_encryptionKey.isEmpty()) {
+            return;
+        }
+        encryptionKey = m_encryptionKey;
+        nameKey = m_nameKey;
+    }
+
+    // Same id the catalog lookup in thumbnail() produces for the output
+    QString name = entryName("content:" + contentHash.toHex(), nameKey);
+    JobScheduler::instance().submit([this, sourcePath, name, encryptionKey]() mutable {
+        if (!QFile::exists(entryPath(name))) {
+            QFile file(sourcePath);
+            QImage image;
+            QString error;
+            if (file.open(QIODevice::ReadOnly)
+                && DecryptedImageProvider::decode(&file, QSize(Size, Size), image, error)) {
+                store(name, encryptionKey, image);
+            }
+        }
+        OPENSSL_cleanse(encryptionKey.data(), encryptionKey.size());
+    }, JobScheduler::Background);
+}
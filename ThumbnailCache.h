@@ -0,0 +1,82 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include "CryptoManager.h"
+
+// 加密缩略图缓存
+// Small JPEG thumbnails of encrypted images, kept on disk so a directory of
+// encrypted photos can be browsed without decrypting every full image.
+//
+// Entries live under <cache location>/thumbnails/<2 hex>/<64 hex>.thm. The
+// name is an HMAC of the plaintext content hash (from the catalog), or of a
+// ciphertext fingerprint for files the catalog does not know, so names reveal
+// neither hashes nor paths. Each file is "SFTH", a version byte, a 12-byte
+// nonce, the 16-byte tag and the JPEG under AES-256-GCM with the name as AAD.
+//
+// The cache key follows the preview credentials: in key mode it is derived
+// from the private key, in password mode from the password with the current
+// KDF and a salt kept in cache.json. Without credentials nothing is read or
+// written.
+//
+// Thumbnails are generated in the background right after an image is
+// encrypted (from the plaintext source), or on the first request for a row.
+class ThumbnailCache
+{
+public:
+    static ThumbnailCache &instance();
+
+    bool setCredentials(const CryptoManager::DecryptionKeys &keys, QString &error);
+    void clearCredentials();
+    bool isEnabled() const;
+
+    // Blocking: from the cache, else decrypted and stored. For worker threads.
+    // Files over MaxSourceSize and files that failed once (not an image, wrong
+    // key) are answered from a negative cache until the credentials change.
+    QImage thumbnail(const QString &encryptedPath, QString &error);
+
+    // Queue a thumbnail of a plaintext image at Background priority
+    void generate(const QString &sourcePath, const QByteArray &contentHash);
+
+    static bool isImageFile(const QString &path);
+    static QString directory();
+
+    // Longest side, in pixels
+    static const int Size = 160;
+    static const int Quality = 80;
+    // Largest encrypted file decrypted into memory for a thumbnail
+    static const qint64 MaxSourceSize = qint64(64) << 20;
+    static const int MaxFailedEntries = 4096;
+
+private:
+    ThumbnailCache() = default;
+    ThumbnailCache(const ThumbnailCache &) = delete;
+    ThumbnailCache &operator=(const ThumbnailCache &) = delete;
+
+    // Catalog content hash of an encrypted file, or a fingerprint of its ciphertext
+    QByteArray entryId(const QString &encryptedPath) const;
+    QString entryName(const QByteArray &id, const QByteArray &nameKey) const;
+    QString entryPath(const QString &name) const;
+
+    bool load(const QString &name, const QByteArray &key, QImage &image) const;
+    bool store(const QString &name, const QByteArray &key, const QImage &image) const;
+    bool generateFromEncrypted(const QString &encryptedPath, const QString &name,
+                               const CryptoManager::DecryptionKeys &keys, const QByteArray &encryptionKey,
+                               QImage &image, QString &error);
+
+    bool passwordKey(const QString &password, QByteArray &key, QString &error);
+
+    CryptoManager m_crypto;
+
+    mutable QMutex m_mutex;
+    CryptoManager::DecryptionKeys m_keys;
+    QByteArray m_encryptionKey;
+    QByteArray m_nameKey;
+    QSet<QString> m_failed; // entry names without a thumbnail
+};
+
+#endif // THUMBNAILCACHE_H
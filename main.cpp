@@ -3,27 +3,59 @@
 #include <QQmlContext>
 #include <QQuickStyle>
 #include "Directoryhandler.h"
+#include "CryptoCli.h"
+#include "CryptoDaemon.h"
+#include "CryptoService.h"
+#include "DecryptedImageProvider.h"
+#include "StorageTuner.h"
 #include <QDir>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQuickWindow>
+#include <QTimer>
+#include <memory>
 
 int main(int argc, char *argv[])
 {
-#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
-    QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
-#endif
-    QGuiApplication app(argc, argv);
+    // 启动耗时统计: time-to-first-frame / time-to-interactive
+    QElapsedTimer startupTimer;
+    startupTimer.start();
 
-    // Set application info for data storage paths
+    // Set application info for data storage paths (shared by GUI and CLI)
     QCoreApplication::setOrganizationName("YourCompany");
     QCoreApplication::setOrganizationDomain("yourcompany.com");
     QCoreApplication::setApplicationName("SecureFileEncryption");
 
+    // 命令行模式: safe cli <command> ...
+    if (argc > 1 && qstrcmp(argv[1], "cli") == 0) {
+        QCoreApplication app(argc, argv);
+        return CryptoCli::run(app.arguments().mid(2));
+    }
+
+    // 守护进程模式: safe daemon (serves "safe cli --daemon" and the GUI)
+    if (argc > 1 && qstrcmp(argv[1], "daemon") == 0) {
+        QCoreApplication app(argc, argv);
+        StorageTuner::enableBackgroundCalibration();
+        return CryptoDaemon::run();
+    }
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+    QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
+#endif
+    QGuiApplication app(argc, argv);
+
     // 确保当前工作目录正确
     QDir::setCurrent(QCoreApplication::applicationDirPath());
     qDebug() << "应用程序工作目录:" << QDir::currentPath();
 
     QQmlApplicationEngine engine;
 
+    // Unknown mounts get their chunk size and queue depth measured when idle
+    StorageTuner::enableBackgroundCalibration();
+
     // Set the offline storage path for database
     engine.setOfflineStoragePath("./");
 
@@ -31,6 +63,14 @@ int main(int argc, char *argv[])
     qmlRegisterType<DirectoryHandler>("com.directory", 1, 0, "DirectoryHandler");
     qDebug() << "已注册DirectoryHandler到QML引擎";
 
+    // Process-wide crypto service; created on first use, not at startup
+    qmlRegisterSingletonType<CryptoService>("com.directory", 1, 0, "CryptoService", &CryptoService::qmlInstance);
+
+    // "image://decrypted/<path>": encrypted images previewed from memory (see setPreviewKey)
+    engine.addImageProvider("decrypted", new DecryptedImageProvider);
+    // "image://thumbnail/<path>": file list thumbnails from the encrypted on-disk cache
+    engine.addImageProvider("thumbnail", new ThumbnailImageProvider);
+
     const QUrl url(QStringLiteral("qrc:/main.qml"));
     QObject::connect(&engine, &QQmlApplicationEngine::objectCreated,
                      &app, [url](QObject *obj, const QUrl &objUrl) {
@@ -42,6 +82,41 @@ int main(int argc, char *argv[])
                          }
                      }, Qt::QueuedConnection);
     engine.load(url);
+    qint64 loadedMs = startupTimer.elapsed();
+
+    // First frame: the first swap of the main window. Interactive: the event loop
+    // is idle again after that frame, i.e. input is being processed.
+    // SAFE_STARTUP_BENCHMARK=<file> writes the numbers as JSON and quits, for tracking over time.
+    QQuickWindow *window = engine.rootObjects().isEmpty()
+                           ? nullptr : qobject_cast<QQuickWindow *>(engine.rootObjects().first());
+    if (window) {
+        auto firstFrame = std::make_shared<QMetaObject::Connection>();
+        *firstFrame = QObject::connect(window, &QQuickWindow::frameSwapped, &app,
+                                       [firstFrame, &startupTimer, loadedMs]() {
+            QObject::disconnect(*firstFrame);
+            qint64 firstFrameMs = startupTimer.elapsed();
+
+            QTimer::singleShot(0, [&startupTimer, loadedMs, firstFrameMs]() {
+                qint64 interactiveMs = startupTimer.elapsed();
+                qDebug() << "启动耗时(ms): QML加载" << loadedMs << "首帧" << firstFrameMs << "可交互" << interactiveMs;
+
+                QString benchmarkFile = qEnvironmentVariable("SAFE_STARTUP_BENCHMARK");
+                if (!benchmarkFile.isEmpty()) {
+                    QJsonObject result;
+                    result["qml_loaded_ms"] = loadedMs;
+                    result["first_frame_ms"] = firstFrameMs;
+                    result["interactive_ms"] = interactiveMs;
+
+                    QFile file(benchmarkFile);
+                    if (file.open(QIODevice::WriteOnly)) {
+                        file.write(QJsonDocument(result).toJson(QJsonDocument::Compact));
+                        file.close();
+                    }
+                    QCoreApplication::quit();
+                }
+            });
+        });
+    }
 
     return app.exec();
 }
@@ -1,5 +1,7 @@
 QT += quick
 QT += quickcontrols2
+QT += sql
+QT += network
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -7,9 +9,33 @@ QT += quickcontrols2
 
 CONFIG += c++17
 
+# Compile QML ahead of time into the binary instead of parsing it at startup
+CONFIG += qtquickcompiler
+
 SOURCES += \
+        BufferPool.cpp \
+        BulkFileOperation.cpp \
+        ContentManifest.cpp \
+        CryptoCli.cpp \
+        CryptoDaemon.cpp \
         CryptoManager.cpp \
+        CryptoMetrics.cpp \
+        CryptoService.cpp \
+        DecryptedImageProvider.cpp \
         Directoryhandler.cpp \
+        EncryptedArchive.cpp \
+        FastFileCopy.cpp \
+        FileCatalog.cpp \
+        JobControl.cpp \
+        JobScheduler.cpp \
+        KdfParams.cpp \
+        LegacyXorDevice.cpp \
+        MemoryBudget.cpp \
+        PageCacheAdvisor.cpp \
+        PreviewCache.cpp \
+        StorageTuner.cpp \
+        StreamEndpoint.cpp \
+        ThumbnailCache.cpp \
         main.cpp
 
 RESOURCES += qml.qrc
@@ -26,8 +52,30 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 HEADERS += \
+    BufferPool.h \
+    BulkFileOperation.h \
+    ContentManifest.h \
+    CryptoCli.h \
+    CryptoDaemon.h \
     CryptoManager.h \
-    Directoryhandler.h
+    CryptoMetrics.h \
+    CryptoService.h \
+    DecryptedImageProvider.h \
+    Directoryhandler.h \
+    EncryptedArchive.h \
+    FastFileCopy.h \
+    FileCatalog.h \
+    JobControl.h \
+    JobScheduler.h \
+    KdfParams.h \
+    LegacyXorDevice.h \
+    MemoryBudget.h \
+    PageCacheAdvisor.h \
+    PreviewCache.h \
+    StorageTuner.h \
+    StreamEndpoint.h \
+    ThreadDigest.h \
+    ThumbnailCache.h
 
 # OpenSSL libraries
 unix {
@@ -42,6 +90,9 @@ win32 {
 
     INCLUDEPATH += $$OPENSSL_PATH/include
     LIBS += -L$$OPENSSL_PATH/lib -llibcrypto -llibssl
+
+    # Token queries of the daemon's peer check
+    LIBS += -ladvapi32
 }
 
 macx {